@@ -2,6 +2,15 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <time.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
 
 enum {
 	STRING,
@@ -14,6 +23,73 @@ enum {
 	LABEL,
 };
 
+/* opcodes for keyword tokens, in the same order as keywords[] */
+enum {
+	KW_IF,
+	KW_THEN,
+	KW_ELSE,
+	KW_FOR,
+	KW_NEXT,
+	KW_EQ,
+	KW_DIVIDE,
+	KW_LPAREN,
+	KW_RPAREN,
+	KW_TIMES,
+	KW_PLUS,
+	KW_MINUS,
+	KW_GOSUB,
+	KW_GOTO,
+	KW_RETURN,
+	KW_PRINT,
+	KW_INPUT,
+	KW_TO,
+	KW_REM,
+	KW_AND,
+	KW_OR,
+	KW_DIM,
+	KW_EXIT,
+	KW_LT,
+	KW_GT,
+	KW_LE,
+	KW_GE,
+	KW_NE,
+	KW_NOT,
+	KW_DEF,
+	KW_FUNCTION,
+	KW_SUB,
+	KW_END,
+	KW_CALL,
+	KW_HASH,
+	KW_OPEN,
+	KW_CLOSE,
+	KW_AS,
+	KW_OUTPUT,
+	KW_APPEND,
+	KW_LINE,
+	KW_READ,
+	KW_WRITE,
+	KW_EOF,
+	KW_SNAPSHOT,
+	KW_MAP,
+	KW_DELETE,
+	KW_COUNT,
+	KW_KEY,
+	KW_HAS,
+	KW_ON,
+	KW_ERROR,
+	KW_PARALLEL,
+	KW_SUM,
+	KW_MIN,
+	KW_MAX,
+	KW_MOD,
+	KW_ABS,
+	KW_SQR,
+	KW_RND,
+	KW_SHL,
+	KW_SHR,
+	KW_RANDOMIZE,
+};
+
 const char *keywords[] = {
 	"IF",
 	"THEN",
@@ -38,6 +114,46 @@ const char *keywords[] = {
 	"OR",
 	"DIM",
 	"EXIT",
+	"<",
+	">",
+	"<=",
+	">=",
+	"<>",
+	"NOT",
+	"DEF",
+	"FUNCTION",
+	"SUB",
+	"END",
+	"CALL",
+	"#",
+	"OPEN",
+	"CLOSE",
+	"AS",
+	"OUTPUT",
+	"APPEND",
+	"LINE",
+	"READ",
+	"WRITE",
+	"EOF",
+	"SNAPSHOT",
+	"MAP",
+	"DELETE",
+	"COUNT",
+	"KEY",
+	"HAS",
+	"ON",
+	"ERROR",
+	"PARALLEL",
+	"SUM",
+	"MIN",
+	"MAX",
+	"MOD",
+	"ABS",
+	"SQR",
+	"RND",
+	"SHL",
+	"SHR",
+	"RANDOMIZE",
 	0,
 };
 
@@ -50,6 +166,31 @@ typedef struct token {
 	} val;
 } Token;
 
+/* values computed at run time fit in 8 bytes: a string is just its
+ * pointer, an integer sits in the low half with the top bit set, which
+ * no user space pointer has */
+typedef uint64_t Value;
+
+Value integerValue(int i) {
+	return (uint64_t)1 << 63 | (uint32_t)i;
+}
+
+Value stringValue(const char *s) {
+	return (uintptr_t)s;
+}
+
+bool isInteger(Value v) {
+	return v >> 63;
+}
+
+int valueInteger(Value v) {
+	return (int)(uint32_t)v;
+}
+
+char *valueString(Value v) {
+	return (char *)(uintptr_t)v;
+}
+
 typedef struct variable {
 	char *identifier;
 	union {
@@ -64,45 +205,227 @@ typedef struct integerArray {
 	int num_integers;
 } IntegerArray;
 
+enum {
+	INLINE_STRING = 12,
+};
+
+/* string array elements shorter than INLINE_STRING are kept in the
+ * element itself, longer ones at an offset in the array's text buffer.
+ * replaced text stays in the buffer as garbage until there is as much
+ * of it as live text, then the buffer is compacted */
+typedef struct stringElement {
+	int len;
+	union {
+		char s[INLINE_STRING];
+		int offset;
+	} val;
+} StringElement;
+
 typedef struct stringArray {
 	char *identifier;
-	char **strings;
+	StringElement *strings;
 	int num_strings;
+	char *text;
+	int text_len, text_max;
+	int garbage;
 } StringArray;
 
+typedef struct mapEntry {
+	Value key, val;
+	unsigned hash;
+} MapEntry;
+
+typedef struct map {
+	char *identifier;
+	MapEntry *entries;
+	int num_entries, max_entries;
+	int *slots; /* entry number+1, 0 when free, -1 when deleted */
+	int num_slots;
+	int tombstones;
+} Map;
+
 typedef struct forLoop {
 	int i1, i2;
 	char *s;
 	int line;
 } ForLoop;
 
-typedef struct program {
+enum {
+	OP_CONST,
+	OP_VAR,
+	OP_ARRAY,
+	OP_NEG,
+	OP_NOT,
+	OP_ABS,
+	OP_SQR,
+	OP_ADD,
+	OP_SUB,
+	OP_MUL,
+	OP_DIV,
+	OP_MOD,
+	OP_MIN,
+	OP_MAX,
+	OP_SHL,
+	OP_SHR,
+	OP_EQ,
+	OP_NE,
+	OP_LT,
+	OP_GT,
+	OP_LE,
+	OP_GE,
+	OP_AND,
+	OP_OR,
+	OP_BOOL,
+	OP_STORE,
+	OP_STOREARRAY,
+	OP_IF,
+};
+
+/* a hot line compiled to integer stack code. operands follow their
+ * opcode in ops */
+typedef struct code {
+	int *ops;
+	int num_ops;
+	int depth, max_depth;
+} Code;
+
+enum {
+	JIT_THRESHOLD = 100,
+	CODE_STACK = 64,
+	MAX_FILES = 16,
+	MAX_CALLS = 1000, /* nested FUNCTION, SUB and DEF calls */
+	CLOCK_INTERVAL = 1024, /* jumps between looking at the clock */
+	WATCH_SLICE = 10000, /* lines run between looking for a save */
+	MAX_CHUNK = 1<<16, /* PARALLEL FOR iterations handed out at once */
+	POOL_MIN = 16, /* free lists hold blocks of 16, 32, 64 and 128 bytes */
+	POOL_CLASSES = 4,
+};
+
+/* how a run ended */
+enum {
+	RUN_DONE,
+	RUN_YIELD,
+	RUN_ERROR,
+	RUN_STEPS,
+	RUN_TIME,
+	RUN_MEMORY,
+	RUN_INPUT, /* waiting for provideInput */
+};
+
+/* lines keep their source text and are only tokenized when first
+ * needed, so editing a line just drops its tokens */
+typedef struct line {
+	char *text;
 	Token *tokens;
-	int num_tokens;
+	int length;
+	bool lexed;
+	int count; /* runs before compiling, -1 if it can't be compiled */
+	Code *code;
+	bool typed; /* checkStatement proved it an integer assignment */
+	int *targets; /* where each jump token leads, +1 so 0 is unknown */
+	bool checked; /* scanned for errors, which happens when first run */
+	int number; /* as typed at the prompt, or its place in the file */
+} Line;
+
+/* locals are the parameters, then the function's own name (holding its
+ * result), then every variable assigned inside the body. anything else
+ * is looked up globally */
+typedef struct function {
+	char *identifier;
+	char **locals;
+	int num_params;
+	int num_locals;
+	int line, end;
+	int expression;
+	bool def;
+} Function;
+
+typedef struct frame {
+	Function *f;
+	Variable *slots;
+	int returnDepth;
+	int forDepth;
+	bool done;
+} Frame;
+
+typedef struct temp {
+	char *s;
+	int depth;
+} Temp;
+
+typedef struct program {
+	Line *lines;
+	int num_lines;
 
 	Variable *integers;
-	int num_integers;
+	int num_integers, max_integers;
 	Variable *strings;
-	int num_strings;
+	int num_strings, max_strings;
 	Variable *labels;
-	int num_labels;
+	int num_labels, max_labels;
 	IntegerArray *integerArrays;
-	int num_integerArrays;
+	int num_integerArrays, max_integerArrays;
 	StringArray *stringArrays;
 	int num_stringArrays;
+	Map *maps;
+	int num_maps;
 
 	char *blank;
-	char *last;
 	int line;
 	bool do_else;
+	bool jit;
 	ForLoop *forLoops;
 	int num_forLoops;
 	int max_forLoops;
 	int *returnLines;
 	int num_returnLines;
 	int max_returnLines;
+
+	Function *functions;
+	int num_functions;
+	Frame *frames;
+	int num_frames;
+	int max_frames;
+	Temp *temps;
+	int num_temps;
+	int max_temps;
+
+	FILE *files[MAX_FILES]; /* #1 is files[0] */
+
+	/* budgets, 0 for none. steps are lines run, memory is the bytes
+	 * held by variables and arrays, time is in milliseconds */
+	long steps, max_steps;
+	long memory, max_memory;
+	long peak_memory; /* the most memory has reached */
+	/* free blocks for each size, linked through their first bytes */
+	void *pools[POOL_CLASSES];
+	long long deadline, max_time;
+	int countdown;
+	long slice, yield_at; /* yield to the host every slice steps */
+	int status;
+
+	FILE *out; /* where PRINT and prompts go */
+	FILE *errors; /* where error messages go */
+	bool sandbox; /* refuse OPEN and SNAPSHOT */
+	bool async_input;
+	char *input; /* the line given to a waiting INPUT */
+	Token *statement, *resume;
+	int statement_n, resume_n;
+
+	jmp_buf *recover; /* set while a host or the prompt runs code */
+	int trap; /* line after ON ERROR GOTO's label, 0 for none */
+	bool direct; /* running a command typed at the prompt */
+	jmp_buf *trapping; /* resumeProgram's recover, where traps apply */
+	int threads; /* for PARALLEL FOR, 0 for one per core */
+	uint64_t seed; /* RND's xorshift state, 0 until RND or RANDOMIZE */
+	FILE *trace; /* being recorded, or replayed */
+	bool replay;
 } Program;
 
+bool isStringName(const char *identifier) {
+	return identifier[0] && identifier[strlen(identifier)-1] == '$';
+}
+
 char *addChar(char *s, int *len, int *max, char c) {
 	s[(*len)++] = c;
 	s[*len] = 0;
@@ -113,71 +436,215 @@ char *addChar(char *s, int *len, int *max, char c) {
 	return s;
 }
 
-void addToken(Program *p, Token t) {
-	p->tokens = realloc(p->tokens, (++(p->num_tokens))*sizeof(Token));
+/* keywords are found with a perfect hash, the seed is searched for
+ * once so that no two keywords share a slot */
 
-	/* don't touch strings >:( */
-	if(t.type == STRING || t.type == SYMBOL) {
-		char *s = malloc(strlen(t.val.s)+1);
-		strcpy(s, t.val.s);
-		t.val.s = s;
-	}
+enum {
+	KEYWORD_SLOTS = 256,
+};
 
-	if(t.type == SYMBOL) {
-		/* all caps for non-strings */
-		for(char *c = t.val.s; *c; c++)
-			if(*c >= 'a' && *c <= 'z')
-				*c -= 'a' - 'A';
+int keywordSlots[KEYWORD_SLOTS]; /* opcode+1, 0 when empty */
+unsigned keywordSeed;
 
-		/* check if string is a keyword */
-		for(const char **kw = keywords; *kw; kw++) {
-			if(strcmp(t.val.s, *kw) == 0) {
-				free(t.val.s);
-				t.val.cs = *kw;
-				t.type = KEYWORD;
-				break;
-			}
-		}
+enum {
+	C_OTHER,
+	C_SPACE,
+	C_QUOTE,
+	C_SPECIAL,
+};
 
-		/* convert integers */
-		bool is_i = t.type != KEYWORD;
-		int n = 0;
-		for(char *c = t.val.s; *c != 0 && is_i; c++) {
-			if(*c <  '0' || *c > '9')
-				is_i = false;
-			else
-				n = n*10 + *c - '0';
+unsigned char charClass[256];
+
+unsigned hashKeyword(const char *s, int len, unsigned seed) {
+	unsigned h = seed;
+	for(int i = 0; i < len; i++)
+		h = (h ^ (unsigned char)s[i])*16777619u;
+	return (h ^ (h >> 15))%KEYWORD_SLOTS;
+}
+
+void initLexer() {
+	if(keywordSeed)
+		return;
+
+	for(unsigned seed = 2166136261u;; seed++) {
+		bool ok = true;
+		memset(keywordSlots, 0, sizeof(keywordSlots));
+		for(int kw = 0; keywords[kw] && ok; kw++) {
+			unsigned h = hashKeyword(keywords[kw],
+					strlen(keywords[kw]), seed);
+			if(keywordSlots[h])
+				ok = false;
+			keywordSlots[h] = kw+1;
 		}
-		if(is_i) {
-			free(t.val.s);
-			t.val.i = n;
-			t.type = INTEGER;
+		if(ok) {
+			keywordSeed = seed;
+			break;
 		}
-		/* seperators */
-		else if(strcmp(t.val.s, ":") == 0) {
-			free(t.val.s);
-			t.type = COLON;
+	}
+
+	charClass[' '] = C_SPACE;
+	charClass['\t'] = C_SPACE;
+	charClass['\r'] = C_SPACE;
+	charClass['"'] = C_QUOTE;
+	for(const char *c = "+-/*(),=<>#"; *c; c++)
+		charClass[(unsigned char)*c] = C_SPECIAL;
+}
+
+/* returns the keyword's opcode, or -1 */
+int findKeyword(const char *s, int len) {
+	int kw = keywordSlots[hashKeyword(s, len, keywordSeed)]-1;
+	if(kw >= 0 && strncmp(keywords[kw], s, len) == 0
+			&& keywords[kw][len] == 0)
+		return kw;
+	return -1;
+}
+
+Token lexSymbol(const char *text, int len) {
+	Token t;
+	char *s = malloc(len+1);
+
+	/* all caps for non-strings */
+	for(int i = 0; i < len; i++)
+		s[i] = (text[i] >= 'a' && text[i] <= 'z')
+			? text[i] - ('a' - 'A') : text[i];
+	s[len] = 0;
+
+	int kw = findKeyword(s, len);
+	if(kw >= 0) {
+		free(s);
+		t.type = KEYWORD;
+		t.val.i = kw;
+		return t;
+	}
+
+	/* convert integers */
+	bool is_i = s[0] >= '0' && s[0] <= '9';
+	int n = 0;
+	for(char *c = s; *c != 0 && is_i; c++) {
+		if(*c <  '0' || *c > '9')
+			is_i = false;
+		else
+			n = (unsigned)n*10 + *c - '0';
+	}
+
+	if(is_i) {
+		free(s);
+		t.type = INTEGER;
+		t.val.i = n;
+	}
+	/* seperators */
+	else if(len == 1 && (*s == ':' || *s == ',')) {
+		t.type = (*s == ':') ? COLON : COMMA;
+		free(s);
+	}
+	/* label */
+	else if(s[len-1] == ':') {
+		s[len-1] = 0;
+		t.type = LABEL;
+		t.val.s = s;
+	}
+	else {
+		t.type = SYMBOL;
+		t.val.s = s;
+	}
+	return t;
+}
+
+/* where the token starting at s ends */
+const char *tokenEnd(const char *s) {
+	const char *c = s+1;
+	switch(charClass[(unsigned char)*s]) {
+	case C_QUOTE:
+		while(*c && *c != '"')
+			c++;
+		return (*c) ? c+1 : c;
+	case C_SPECIAL:
+		/* two character comparisons */
+		if((*s == '<' && (*c == '=' || *c == '>'))
+				|| (*s == '>' && *c == '='))
+			c++;
+		return c;
+	}
+	while(*c && charClass[(unsigned char)*c] == C_OTHER)
+		c++;
+	return c;
+}
+
+/* the column (from 1) where token i of a line starts, or just past the
+ * end of the text for i == length */
+int tokenColumn(Line *l, int i) {
+	const char *c = l->text;
+	for(;;) {
+		while(charClass[(unsigned char)*c] == C_SPACE)
+			c++;
+		if(!*c || !i--)
+			return c-l->text+1;
+		c = tokenEnd(c);
+	}
+}
+
+void lexLine(Line *l) {
+	int max = 8;
+	Token *tokens = malloc(sizeof(Token)*max);
+	int n = 0;
+
+	for(const char *c = l->text; *c;) {
+		Token t;
+		const char *s = c;
+
+		if(charClass[(unsigned char)*c] == C_SPACE) {
+			c++;
+			continue;
 		}
-		else if(strcmp(t.val.s, ",") == 0) {
-			free(t.val.s);
-			t.type = COMMA;
+		c = tokenEnd(s);
+		if(*s == '"') {
+			/* the closing quote may be missing */
+			int len = ((c > s+1 && c[-1] == '"') ? c-1 : c)-s-1;
+			t.type = STRING;
+			t.val.s = malloc(len+1);
+			memcpy(t.val.s, s+1, len);
+			t.val.s[len] = 0;
 		}
-		/* label */
-		else if(t.val.s[strlen(t.val.s)-1] == ':') {
-			t.val.s[strlen(t.val.s)-1] = 0;
-			t.type = LABEL;
+		else
+			t = lexSymbol(s, c-s);
+
+		if(n == max) {
+			max *= 2;
+			tokens = realloc(tokens, sizeof(Token)*max);
 		}
+		tokens[n++] = t;
 	}
 
-	p->tokens[p->num_tokens-1] = t;
+	l->tokens = tokens;
+	l->length = n;
+	l->lexed = true;
+}
+
+/* lines are numbered from 0 here */
+Line *getLine(Program *p, int line) {
+	Line *l = &p->lines[line];
+	if(!l->lexed)
+		lexLine(l);
+	return l;
+}
+
+/* the first word of a line, in caps, without tokenizing it */
+void firstWord(Line *l, char *s, int max) {
+	const char *c = l->text;
+	while(charClass[(unsigned char)*c] == C_SPACE)
+		c++;
+	int len = 0;
+	for(; *c && charClass[(unsigned char)*c] == C_OTHER && len < max-1; c++)
+		s[len++] = (*c >= 'a' && *c <= 'z') ? *c - ('a' - 'A') : *c;
+	s[len] = 0;
 }
 
 Program *newProgram() {
+	initLexer();
 	Program *p = malloc(sizeof(Program));
-	*p = (Program){0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+	*p = (Program){0};
 	p->blank = malloc(1);
 	p->blank[0] = 0;
-	p->last = 0;
 	p->do_else = false;
 	p->max_forLoops = 20;
 	p->forLoops = malloc(p->max_forLoops*sizeof(ForLoop));
@@ -185,63 +652,307 @@ Program *newProgram() {
 	p->max_returnLines = 20;
 	p->returnLines = malloc(p->max_returnLines*sizeof(int));
 	p->num_returnLines = 0;
+	p->max_frames = 20;
+	p->frames = malloc(p->max_frames*sizeof(Frame));
+	p->num_frames = 0;
+	p->max_temps = 20;
+	p->temps = malloc(p->max_temps*sizeof(Temp));
+	p->num_temps = 0;
+	p->out = stdout;
+	p->errors = stdout;
 	return p;
 }
 
-void freeToken(Token t) { /* something to do with gosub doesnt work... */
-	if(t.type == STRING || t.type == LABEL /*|| t.type == SYMBOL*/)
+void freeToken(Token t) {
+	if(t.type == STRING || t.type == LABEL || t.type == SYMBOL)
 		free(t.val.s);
 }
 
-void freeProgram(Program *p) {
-	free(p->forLoops);
-	free(p->returnLines);
+void freeLine(Line *l) {
+	free(l->targets);
+	if(l->lexed) {
+		for(int i = 0; i < l->length; i++)
+			freeToken(l->tokens[i]);
+		free(l->tokens);
+	}
+	if(l->code) {
+		free(l->code->ops);
+		free(l->code);
+	}
+	free(l->text);
+}
+
+void release(Program *p, void *b, long size);
+void freeString(Program *p, char *s);
 
-	for(int i = 0; i < p->num_tokens; i++)
-		freeToken(p->tokens[i]);
-	if(p->tokens)
-		free(p->tokens);
+void freeFrame(Program *p, Frame *f) {
+	for(int i = 0; i < f->f->num_locals; i++)
+		if(isStringName(f->slots[i].identifier))
+			freeString(p, f->slots[i].val.s);
+	release(p, f->slots, sizeof(Variable)*f->f->num_locals);
+}
+
+void clearMap(Program *p, Map *m);
+void drainPools(Program *p);
+int findLine(Program *p, int number);
+int lineNumber(Program *p, int line);
 
+/* drops every variable and array but keeps the program */
+void clearVariables(Program *p) {
 	for(int i = 0; i < p->num_strings; i++) {
 		free(p->strings[i].identifier);
 		free(p->strings[i].val.s);
 	}
-	if(p->strings)
-		free(p->strings);
+	free(p->strings);
+	p->strings = 0;
+	p->num_strings = 0;
+	p->max_strings = 0;
 
 	for(int i = 0; i < p->num_integers; i++)
 		free(p->integers[i].identifier);
-	if(p->integers)
-		free(p->integers);
+	free(p->integers);
+	p->integers = 0;
+	p->num_integers = 0;
+	p->max_integers = 0;
 
 	for(int i = 0; i < p->num_integerArrays; i++) {
 		free(p->integerArrays[i].identifier);
 		free(p->integerArrays[i].integers);
 	}
-	if(p->integerArrays)
-		free(p->integerArrays);
+	free(p->integerArrays);
+	p->integerArrays = 0;
+	p->num_integerArrays = 0;
+	p->max_integerArrays = 0;
 
 	for(int i = 0; i < p->num_stringArrays; i++) {
-		for(int j = 0; j < p->stringArrays[i].num_strings; j++)
-			if(p->stringArrays[i].strings[j])
-				free(p->stringArrays[i].strings[j]);
 		free(p->stringArrays[i].strings);
+		free(p->stringArrays[i].text);
+		free(p->stringArrays[i].identifier);
+	}
+	free(p->stringArrays);
+	p->stringArrays = 0;
+	p->num_stringArrays = 0;
+
+	for(int i = 0; i < p->num_maps; i++) {
+		clearMap(p, &p->maps[i]);
+		free(p->maps[i].identifier);
 	}
-	if(p->stringArrays)
-		free(p->stringArrays);
+	free(p->maps);
+	p->maps = 0;
+	p->num_maps = 0;
+	drainPools(p);
+	p->memory = 0;
+	p->seed = 0;
+
+	/* compiled lines refer to variables by index */
+	for(int i = 0; i < p->num_lines; i++) {
+		Line *l = &p->lines[i];
+		if(l->code) {
+			free(l->code->ops);
+			free(l->code);
+			l->code = 0;
+		}
+		l->count = 0;
+	}
+}
+
+/* forgets where the program was, as after an error at the prompt */
+void resetProgram(Program *p) {
+	for(int i = 0; i < p->num_frames; i++)
+		freeFrame(p, &p->frames[i]);
+	p->num_frames = 0;
+	for(int i = 0; i < p->num_temps; i++)
+		free(p->temps[i].s);
+	p->num_temps = 0;
+	p->num_forLoops = 0;
+	p->num_returnLines = 0;
+	p->do_else = false;
+	p->resume = 0;
+	p->trap = 0;
+	p->direct = false;
+}
+
+void freeProgram(Program *p) {
+	clearVariables(p);
+	for(int i = 0; i < MAX_FILES; i++)
+		if(p->files[i])
+			fclose(p->files[i]);
+	if(p->trace)
+		fclose(p->trace);
+	free(p->forLoops);
+	free(p->returnLines);
+
+	for(int i = 0; i < p->num_frames; i++)
+		freeFrame(p, &p->frames[i]);
+	free(p->frames);
+	for(int i = 0; i < p->num_temps; i++)
+		free(p->temps[i].s);
+	free(p->temps);
+
+	for(int i = 0; i < p->num_functions; i++)
+		free(p->functions[i].locals);
+	if(p->functions)
+		free(p->functions);
+	for(int i = 0; i < p->num_lines; i++)
+		freeLine(&p->lines[i]);
+	if(p->lines)
+		free(p->lines);
 
 	if(p->labels)
 		free(p->labels);
 	if(p->blank)
 		free(p->blank);
+	free(p->input);
 
 	free(p);
 }
 
-void syntaxError(Program *p) {
-	printf("SYNTAX ERROR AT LINE %d\n", p->line);
+/* ends the run. whoever set p->recover gets control back, otherwise
+ * the process exits */
+_Noreturn void stopProgram(Program *p, int status) {
+	p->status = status;
+	if(p->recover)
+		longjmp(*p->recover, 1);
 	freeProgram(p);
-	exit(1);
+	exit(status != RUN_DONE);
+}
+
+/* ON ERROR only catches errors in resumeProgram, and those aren't
+ * printed so a handled error doesn't look like a crash */
+bool errorTrapped(Program *p) {
+	return p->trap && p->recover && p->recover == p->trapping;
+}
+
+_Noreturn void syntaxError(Program *p) {
+	if(!errorTrapped(p)) {
+		/* a command typed at the prompt has no line of its own */
+		if(p->direct && !p->num_frames)
+			fprintf(p->errors, "SYNTAX ERROR IN DIRECT MODE\n");
+		else
+			fprintf(p->errors, "SYNTAX ERROR AT LINE %d\n",
+					lineNumber(p, p->line));
+	}
+	stopProgram(p, RUN_ERROR);
+}
+
+/* prints why, then stops as syntaxError does */
+_Noreturn void runError(Program *p, const char *fmt, ...) {
+	if(!errorTrapped(p)) {
+		va_list args;
+		va_start(args, fmt);
+		vfprintf(p->errors, fmt, args);
+		va_end(args);
+	}
+	syntaxError(p);
+}
+
+long long milliseconds() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec*1000ll + t.tv_nsec/1000000;
+}
+
+/* runs on every jump and call, which a runaway loop can't avoid. the
+ * clock is only read every CLOCK_INTERVAL times */
+void checkBudgets(Program *p) {
+	if(p->max_steps && p->steps > p->max_steps) {
+		fprintf(p->errors, "STEP LIMIT REACHED AT LINE %d\n",
+				lineNumber(p, p->line));
+		stopProgram(p, RUN_STEPS);
+	}
+	if(p->deadline && --(p->countdown) <= 0) {
+		p->countdown = CLOCK_INTERVAL;
+		if(milliseconds() > p->deadline) {
+			fprintf(p->errors, "TIME LIMIT REACHED AT LINE %d\n",
+					lineNumber(p, p->line));
+			stopProgram(p, RUN_TIME);
+		}
+	}
+}
+
+/* counts bytes taken (or given back) by variables, arrays, call frames
+ * and the FOR and GOSUB stacks. callers count before allocating, so
+ * stopping here leaks nothing */
+void useMemory(Program *p, long bytes) {
+	p->memory += bytes;
+	if(p->max_memory && bytes > 0 && p->memory > p->max_memory) {
+		fprintf(p->errors, "OUT OF MEMORY AT LINE %d\n",
+				lineNumber(p, p->line));
+		stopProgram(p, RUN_MEMORY);
+	}
+	if(p->memory > p->peak_memory)
+		p->peak_memory = p->memory;
+}
+
+/* strings held by variables and maps come from per-size free lists, so
+ * reassigning one in a loop reuses a block instead of calling malloc.
+ * small blocks are counted at their rounded up size */
+long blockSize(long size) {
+	long s = POOL_MIN;
+	while(s < size)
+		s *= 2;
+	return (s <= (long)POOL_MIN << (POOL_CLASSES-1)) ? s : size;
+}
+
+int poolClass(long size) {
+	int c = 0;
+	while((long)POOL_MIN << c < size)
+		c++;
+	return c;
+}
+
+void *allocate(Program *p, long size) {
+	size = blockSize(size);
+	useMemory(p, size);
+	int c = poolClass(size);
+	if(c < POOL_CLASSES && p->pools[c]) {
+		void *b = p->pools[c];
+		p->pools[c] = *(void**)b;
+		return b;
+	}
+	return malloc(size);
+}
+
+void release(Program *p, void *b, long size) {
+	size = blockSize(size);
+	useMemory(p, -size);
+	int c = poolClass(size);
+	if(c >= POOL_CLASSES) {
+		free(b);
+		return;
+	}
+	*(void**)b = p->pools[c];
+	p->pools[c] = b;
+}
+
+void drainPools(Program *p) {
+	for(int c = 0; c < POOL_CLASSES; c++)
+		while(p->pools[c]) {
+			void *b = p->pools[c];
+			p->pools[c] = *(void**)b;
+			free(b);
+		}
+}
+
+char *copyString(Program *p, const char *s) {
+	char *c = allocate(p, strlen(s)+1);
+	strcpy(c, s);
+	return c;
+}
+
+void freeString(Program *p, char *s) {
+	release(p, s, strlen(s)+1);
+}
+
+/* makes room for one more element, doubling the table so new
+ * variables don't each cost a realloc */
+void *growTable(Program *p, void *table, int num, int *max, size_t size) {
+	if(num < *max)
+		return table;
+	int n = (*max) ? *max*2 : 16;
+	useMemory(p, (long)(n-*max)*size);
+	*max = n;
+	return realloc(table, size*n);
 }
 
 void syntaxAssert(Program *p, bool cond) {
@@ -249,31 +960,51 @@ void syntaxAssert(Program *p, bool cond) {
 		syntaxError(p);
 }
 
-int lineLength(Program *p, int d) {
-	for(int i = d; i < p->num_tokens; i++)
-		if(p->tokens[i].type == NEWLINE)
-			return (i-d);
-	return (p->num_tokens-d);
+bool isKeyword(Token t, int kw) {
+	return t.type == KEYWORD && t.val.i == kw;
+}
+
+Variable *getLocal(Program *p, char *identifier) {
+	if(!p->num_frames)
+		return 0;
+	Frame *f = &p->frames[p->num_frames-1];
+	for(int i = 0; i < f->f->num_locals; i++)
+		if(strcmp(f->slots[i].identifier, identifier) == 0)
+			return &f->slots[i];
+	return 0;
 }
 
 void setStringVariable(Program *p, char *identifier, char *s) {
+	Variable *l = getLocal(p, identifier);
+	if(l) {
+		char *o = l->val.s;
+		l->val.s = copyString(p, s);
+		freeString(p, o);
+		return;
+	}
+
+	/* s may be the string being replaced */
 	for(int i = 0; i < p->num_strings; i++)
 		if(strcmp(p->strings[i].identifier, identifier) == 0) {
-			free(p->strings[i].val.s);
-			p->strings[i].val.s = malloc(strlen(s)+1);
-			strcpy(p->strings[i].val.s, s);
+			char *o = p->strings[i].val.s;
+			p->strings[i].val.s = copyString(p, s);
+			freeString(p, o);
 			return;
 		}
 
-	p->strings = realloc(p->strings, sizeof(Variable)*(++(p->num_strings)));
-	Variable *v = &p->strings[p->num_strings-1];
+	p->strings = growTable(p, p->strings, p->num_strings,
+			&p->max_strings, sizeof(Variable));
+	char *c = copyString(p, s);
+	Variable *v = &p->strings[p->num_strings++];
 	v->identifier = malloc(strlen(identifier)+1);
 	strcpy(v->identifier, identifier);
-	v->val.s = malloc(strlen(s)+1);
-	strcpy(v->val.s, s);
+	v->val.s = c;
 }
 
 char *getStringVariable(Program *p, char *identifier) {
+	Variable *l = getLocal(p, identifier);
+	if(l)
+		return l->val.s;
 	for(int i = 0; i < p->num_strings; i++)
 		if(strcmp(p->strings[i].identifier, identifier) == 0)
 			return p->strings[i].val.s;
@@ -281,21 +1012,29 @@ char *getStringVariable(Program *p, char *identifier) {
 }
 
 void setIntegerVariable(Program *p, char *identifier, int d) {
+	Variable *l = getLocal(p, identifier);
+	if(l) {
+		l->val.i = d;
+		return;
+	}
 	for(int i = 0; i < p->num_integers; i++)
 		if(strcmp(p->integers[i].identifier, identifier) == 0) {
 			p->integers[i].val.i = d;
 			return;
 		}
 
-	p->integers = realloc(p->integers, sizeof(Variable)*
-			(++(p->num_integers)));
-	Variable *v = &p->integers[p->num_integers-1];
+	p->integers = growTable(p, p->integers, p->num_integers,
+			&p->max_integers, sizeof(Variable));
+	Variable *v = &p->integers[p->num_integers++];
 	v->identifier = malloc(strlen(identifier)+1);
 	strcpy(v->identifier, identifier);
 	v->val.i = d;
 }
 
 int getIntegerVariable(Program *p, char *identifier) {
+	Variable *l = getLocal(p, identifier);
+	if(l)
+		return l->val.i;
 	for(int i = 0; i < p->num_integers; i++)
 		if(strcmp(p->integers[i].identifier, identifier) == 0)
 			return p->integers[i].val.i;
@@ -306,6 +1045,7 @@ void dimIntegerArray(Program *p, char *identifier, int sz) {
 	for(int i = 0; i < p->num_integerArrays; i++) {
 		if(strcmp(p->integerArrays[i].identifier, identifier) == 0) {
 			IntegerArray *a = &p->integerArrays[i];
+			useMemory(p, ((long)sz-a->num_integers)*sizeof(int));
 			free(a->integers);
 			a->integers = malloc(sizeof(int)*sz);
 			a->num_integers = sz;
@@ -315,9 +1055,11 @@ void dimIntegerArray(Program *p, char *identifier, int sz) {
 		}
 	}
 
-	p->integerArrays = realloc(p->integerArrays,
-			sizeof(IntegerArray)*(++(p->num_integerArrays)));
-	IntegerArray *a = &p->integerArrays[p->num_integerArrays-1];
+	p->integerArrays = growTable(p, p->integerArrays,
+			p->num_integerArrays, &p->max_integerArrays,
+			sizeof(IntegerArray));
+	useMemory(p, (long)sz*sizeof(int));
+	IntegerArray *a = &p->integerArrays[p->num_integerArrays++];
 	a->integers = malloc(sizeof(int)*sz);
 	a->num_integers = sz;
 	for(int i = 0; i < sz; i++)
@@ -333,12 +1075,10 @@ int *pIntegerArrayVal(Program *p, char *identifier, int d) {
 				== 0)
 			a = &p->integerArrays[i];
 	if(!a) {
-		printf("COULD NOT FIND %s\n", identifier);
-		syntaxError(p);
+		runError(p, "COULD NOT FIND %s\n", identifier);
 	}
 	if(d < 1 || d > a->num_integers) {
-		printf("INVALID ARRAY INDEX %d\n", d);
-		syntaxError(p);
+		runError(p, "INVALID ARRAY INDEX %d\n", d);
 	}
 	return &a->integers[d-1];
 }
@@ -352,208 +1092,747 @@ int getIntegerArrayVal(Program *p, char *identifier, int d) {
 	return n;
 }
 
+/* empties a, which must not hold anything yet */
+void initStringArray(StringArray *a, int sz) {
+	a->strings = calloc(sz, sizeof(StringElement));
+	a->num_strings = sz;
+	a->text = 0;
+	a->text_len = 0;
+	a->text_max = 0;
+	a->garbage = 0;
+}
+
 void dimStringArray(Program *p, char *identifier, int sz) {
 	for(int i = 0; i < p->num_stringArrays; i++) {
 		if(strcmp(p->stringArrays[i].identifier, identifier) == 0) {
 			StringArray *a = &p->stringArrays[i];
-			for(int j = 0; j < a->num_strings; j++)
-				if(a->strings[j])
-					free(a->strings[i]);
+			useMemory(p, ((long)sz-a->num_strings)*sizeof(StringElement)
+					- a->text_max);
 			free(a->strings);
-			a->strings = malloc(sizeof(char*)*sz);
-			a->num_strings = sz;
-			for(int j = 0; j < a->num_strings; j++)
-				a->strings[j] = 0;
+			free(a->text);
+			initStringArray(a, sz);
 			return;
 		}
 	}
 
+	useMemory(p, (long)sz*sizeof(StringElement));
 	p->stringArrays = realloc(p->stringArrays,
 			sizeof(StringArray)*(++(p->num_stringArrays)));
 	StringArray *a = &p->stringArrays[p->num_stringArrays-1];
-	a->strings = malloc(sizeof(char*)*sz);
-	a->num_strings = sz;
-	for(int i = 0; i < a->num_strings; i++)
-		a->strings[i] = 0;
-
 	a->identifier = malloc(strlen(identifier)+1);
 	strcpy(a->identifier, identifier);
+	initStringArray(a, sz);
 }
 
 StringArray *pStringArray(Program *p, char *identifier) {
 	for(int i = 0; i < p->num_stringArrays; i++)
 		if(strcmp(p->stringArrays[i].identifier, identifier) == 0)
 			return &p->stringArrays[i];
-	printf("COULD NOT FIND %s\n", identifier);
-	syntaxError(p);
+	runError(p, "COULD NOT FIND %s\n", identifier);
+}
+
+char *elementText(StringArray *a, int i) {
+	StringElement *e = &a->strings[i];
+	if(e->len < INLINE_STRING)
+		return e->val.s;
+	return a->text+e->val.offset;
+}
+
+/* copies the live text to a buffer of its own size */
+void compactStringArray(Program *p, StringArray *a) {
+	int max = a->text_len-a->garbage;
+	char *text = malloc(max);
+	int len = 0;
+	for(int i = 0; i < a->num_strings; i++) {
+		StringElement *e = &a->strings[i];
+		if(e->len < INLINE_STRING)
+			continue;
+		memcpy(text+len, a->text+e->val.offset, e->len+1);
+		e->val.offset = len;
+		len += e->len+1;
+	}
+	useMemory(p, max-a->text_max);
+	free(a->text);
+	a->text = text;
+	a->text_len = len;
+	a->text_max = max;
+	a->garbage = 0;
+}
+
+void setStringElement(Program *p, StringArray *a, int i, const char *s) {
+	StringElement *e = &a->strings[i];
+	int len = strlen(s);
+
+	/* text that is rewritten in place or shorter */
+	if(e->len >= len && len >= INLINE_STRING) {
+		memmove(a->text+e->val.offset, s, len+1);
+		a->garbage += e->len-len;
+		e->len = len;
+		return;
+	}
+
+	/* s may be text of this array, which can move */
+	char *copy = 0;
+	if(s >= a->text && s < a->text+a->text_len) {
+		copy = malloc(len+1);
+		memcpy(copy, s, len+1);
+		s = copy;
+	}
+
+	if(e->len >= INLINE_STRING)
+		a->garbage += e->len+1;
+	e->len = 0;
+	e->val.s[0] = 0;
+
+	if(len < INLINE_STRING)
+		memcpy(e->val.s, s, len+1);
+	else {
+		if(a->garbage > a->text_len/2)
+			compactStringArray(p, a);
+		if(a->text_len+len+1 > a->text_max) {
+			int max = (a->text_len+len+1)*2;
+			useMemory(p, max-a->text_max);
+			a->text = realloc(a->text, max);
+			a->text_max = max;
+		}
+		memcpy(a->text+a->text_len, s, len+1);
+		e->val.offset = a->text_len;
+		a->text_len += len+1;
+	}
+	e->len = len;
+	free(copy);
 }
 
 void setStringArrayVal(Program *p, char *identifier, int d, char *s) {
 	StringArray *a = pStringArray(p, identifier);
 	if(d < 1 || d > a->num_strings) {
-		printf("INVALID INDEX %d\n", d);
-		syntaxError(p);
+		runError(p, "INVALID INDEX %d\n", d);
 	}
-	if(a->strings[d-1])
-		free(a->strings[d-1]);
-	a->strings[d-1] = malloc(strlen(s)+1);
-	strcpy(a->strings[d-1], s);
+	setStringElement(p, a, d-1, s);
 }
 
 char *getStringArrayVal(Program *p, char *identifier, int d) {
 	StringArray *a = pStringArray(p, identifier);
 	if(d < 1 || d > a->num_strings) {
-		printf("INVALID INDEX %d\n", d);
-		syntaxError(p);
+		runError(p, "INVALID INDEX %d\n", d);
 	}
-	if(!a->strings[d-1])
-		return p->blank;
-	return a->strings[d-1];
+	return elementText(a, d-1);
 }
 
-void addLabel(Program *p, char *s, int line) {
-	p->labels = realloc(p->labels, sizeof(Variable)*(++(p->num_labels)));
-	Variable v;
-	v.identifier = s;
-	v.val.i = line;
-	p->labels[p->num_labels-1] = v;
-}
+/* DIM m AS MAP makes a dictionary keyed by strings or integers, holding
+ * integers (or strings for m$). entries are kept densely in insertion
+ * order, so KEY(m, i) can walk them, and an open addressing table of
+ * entry numbers finds them by key. deleting moves the last entry into
+ * the hole and leaves a tombstone in the table */
 
-int getLabelLine(Program *p, char *s) {
-	for(int i = 0; i < p->num_labels; i++)
-		if(strcmp(p->labels[i].identifier, s) == 0)
-			return p->labels[i].val.i;
-	syntaxError(p);
+Map *getMap(Program *p, char *identifier) {
+	for(int i = 0; i < p->num_maps; i++)
+		if(strcmp(p->maps[i].identifier, identifier) == 0)
+			return &p->maps[i];
+	return 0;
 }
 
-void loadString(Program *p, char *text) {
-	int max = 20;
-	char *s = malloc(max);
-	int len = 0;
+void freeMapEntry(Program *p, MapEntry *e) {
+	if(!isInteger(e->key))
+		freeString(p, valueString(e->key));
+	if(!isInteger(e->val))
+		freeString(p, valueString(e->val));
+}
 
-	Token t;
-	bool quote = false;
+void clearMap(Program *p, Map *m) {
+	for(int i = 0; i < m->num_entries; i++)
+		freeMapEntry(p, &m->entries[i]);
+	useMemory(p, -(long)m->max_entries*sizeof(MapEntry)
+			- (long)m->num_slots*sizeof(int));
+	free(m->entries);
+	free(m->slots);
+	m->entries = 0;
+	m->num_entries = 0;
+	m->max_entries = 0;
+	m->slots = 0;
+	m->num_slots = 0;
+	m->tombstones = 0;
+}
 
-	const char *schars = "+-/*(),";
+void dimMap(Program *p, char *identifier) {
+	Map *m = getMap(p, identifier);
+	if(m) {
+		clearMap(p, m);
+		return;
+	}
+	p->maps = realloc(p->maps, sizeof(Map)*(++(p->num_maps)));
+	m = &p->maps[p->num_maps-1];
+	*m = (Map){malloc(strlen(identifier)+1), 0, 0, 0, 0, 0, 0};
+	strcpy(m->identifier, identifier);
+}
 
-	for(char *c = text; *c; c++) {
-		if(*c == '\n') {
-			if(len) {
-				t.val.s = s;
-				t.type = (quote) ? STRING : SYMBOL;
-				addToken(p, t);
-				len = 0;
-			}
-			quote = false;
-			t.type = NEWLINE;
-			addToken(p, t);
-			continue;
-		}
+unsigned hashKey(Value k) {
+	unsigned h = 2166136261u;
+	if(isInteger(k))
+		h = (unsigned)valueInteger(k)*2654435769u;
+	else
+		for(const char *c = valueString(k); *c; c++)
+			h = (h ^ (unsigned char)*c)*16777619u;
+	return h ^ (h >> 16);
+}
 
-		if(quote) {
-			if(*c == '"') {
-				t.val.s[len] = 0;
-				t.val.s = s;
-				t.type = STRING;
-				addToken(p, t);
-				len = 0;
-				quote = false;
-			}
-			else
-				s = addChar(s, &len, &max, *c);
+/* the table slot holding key, or the free one it would go in */
+int *findSlot(Map *m, Value k, unsigned h) {
+	int *tomb = 0;
+	unsigned mask = m->num_slots-1;
+	for(unsigned i = h & mask;; i = (i+1) & mask) {
+		int s = m->slots[i];
+		if(s == 0)
+			return (tomb) ? tomb : &m->slots[i];
+		if(s < 0) {
+			if(!tomb)
+				tomb = &m->slots[i];
 			continue;
 		}
+		MapEntry *e = &m->entries[s-1];
+		if(e->hash == h && (e->key == k || (!isInteger(k)
+				&& !isInteger(e->key)
+				&& strcmp(valueString(e->key), valueString(k)) == 0)))
+			return &m->slots[i];
+	}
+}
 
-		if(*c == '"') {
-			if(len) {
-				t.val.s = s;
-				t.type = SYMBOL;
-				addToken(p, t);
-				len = 0;
-			}
-			quote = true;
-			continue;
-		}
+/* rebuilds the table at a size that keeps it under 3/4 full */
+void rehashMap(Program *p, Map *m, int entries) {
+	int sz = 8;
+	while(sz < entries*2)
+		sz *= 2;
+	useMemory(p, ((long)sz-m->num_slots)*sizeof(int));
+	free(m->slots);
+	m->slots = calloc(sz, sizeof(int));
+	m->num_slots = sz;
+	m->tombstones = 0;
+	for(int i = 0; i < m->num_entries; i++)
+		*findSlot(m, m->entries[i].key, m->entries[i].hash) = i+1;
+}
 
-		bool spec = false;
-		for(const char *h = schars; *h && !spec; h++)
-			if(*c == *h)
-				spec = true;
-		if(spec) {
-			if(len) {
-				t.val.s = s;
-				t.type = SYMBOL;
-				addToken(p, t);
-				len = 0;
-			}
-			s[0] = *c;
-			s[1] = 0;
-			t.type = SYMBOL;
-			t.val.s = s;
-			addToken(p, t);
-			continue;
-		}
+MapEntry *findEntry(Map *m, Value k) {
+	if(!m->num_entries)
+		return 0;
+	int s = *findSlot(m, k, hashKey(k));
+	return (s > 0) ? &m->entries[s-1] : 0;
+}
 
-		if(*c == ' ' || *c == '\t') {
-			if(len) {
-				t.type = SYMBOL;
-				t.val.s = s;
-				addToken(p, t);
-				len = 0;
-			}
-			continue;
+void setMapVal(Program *p, Map *m, Value k, Value v) {
+	bool is_str = isStringName(m->identifier);
+	syntaxAssert(p, isInteger(v) != is_str);
+
+	if((m->num_entries+m->tombstones+1)*4 > m->num_slots*3)
+		rehashMap(p, m, m->num_entries+1);
+	unsigned h = hashKey(k);
+	int *slot = findSlot(m, k, h);
+
+	MapEntry *e;
+	if(*slot > 0) {
+		e = &m->entries[*slot-1];
+		/* v may be the value being replaced */
+		if(is_str) {
+			char *s = copyString(p, valueString(v));
+			freeString(p, valueString(e->val));
+			v = stringValue(s);
 		}
-
-		s = addChar(s, &len, &max, *c);
 	}
-
-	if(len) {
-		t.val.s = s;
-		t.type = SYMBOL;
-		addToken(p, t);
+	else {
+		if(m->num_entries == m->max_entries) {
+			int max = (m->max_entries) ? m->max_entries*2 : 8;
+			useMemory(p, ((long)max-m->max_entries)*sizeof(MapEntry));
+			m->entries = realloc(m->entries, sizeof(MapEntry)*max);
+			m->max_entries = max;
+		}
+		if(!isInteger(k))
+			k = stringValue(copyString(p, valueString(k)));
+		if(is_str)
+			v = stringValue(copyString(p, valueString(v)));
+		if(*slot < 0)
+			m->tombstones--;
+		e = &m->entries[m->num_entries++];
+		*slot = m->num_entries;
+		e->key = k;
+		e->hash = h;
 	}
 
-	if(p->tokens[p->num_tokens-1].type != NEWLINE) {
-		Token t;
-		t.type = NEWLINE;
-		addToken(p, t);
-	}
+	e->val = v;
+}
 
-	free(s);
+/* missing keys read as 0 or an empty string, like variables */
+Value getMapVal(Program *p, Map *m, Value k) {
+	MapEntry *e = findEntry(m, k);
+	if(e)
+		return e->val;
+	if(isStringName(m->identifier))
+		return stringValue(p->blank);
+	return integerValue(0);
+}
 
-	/* collect labels */
+void deleteMapVal(Program *p, Map *m, Value k) {
+	if(!m->num_entries)
+		return;
+	int *slot = findSlot(m, k, hashKey(k));
+	if(*slot <= 0)
+		return;
+
+	int i = *slot-1;
+	MapEntry *e = &m->entries[i];
+	freeMapEntry(p, e);
+	*slot = -1;
+	m->tombstones++;
+
+	/* the last entry fills the hole */
+	if(i != --(m->num_entries)) {
+		MapEntry *last = &m->entries[m->num_entries];
+		*findSlot(m, last->key, last->hash) = i+1;
+		*e = *last;
+	}
+}
 
-	int line = 0;
-	for(int i = 0; i < p->num_tokens; i++) {
-		line++;
-		if(p->tokens[i].type == LABEL)
-			addLabel(p, p->tokens[i].val.s, line);
-		int l = lineLength(p, i);
-		i += l;
+void addLabel(Program *p, char *s, int line) {
+	if(p->num_labels == p->max_labels) {
+		p->max_labels = (p->max_labels) ? p->max_labels*2 : 16;
+		p->labels = realloc(p->labels, sizeof(Variable)*p->max_labels);
 	}
+	Variable v;
+	v.identifier = s;
+	v.val.i = line;
+	p->labels[p->num_labels++] = v;
 }
 
-char *getString() {
-	printf("?");
+/* the line after a label, or 0 if there is no such label */
+int findLabel(Program *p, char *s) {
+	for(int i = 0; i < p->num_labels; i++)
+		if(strcmp(p->labels[i].identifier, s) == 0)
+			return p->labels[i].val.i;
+	return 0;
+}
+
+int getLabelLine(Program *p, char *s) {
+	int line = findLabel(p, s);
+	if(!line)
+		syntaxError(p);
+	return line;
+}
+
+/* GOTO, GOSUB and ON go after a label, or to a line by the number LIST
+ * shows for it. returns the line to run next, or -1 if there is none */
+int targetLine(Program *p, Token t) {
+	if(t.type == INTEGER) {
+		int i = findLine(p, t.val.i);
+		return (i >= 0) ? i : -1;
+	}
+	if(t.type == SYMBOL && findLabel(p, t.val.s))
+		return findLabel(p, t.val.s);
+	return -1;
+}
+
+/* targets in the running line are looked up once and kept with it,
+ * until an edit moves the lines */
+int jumpTarget(Program *p, Token *t) {
+	Line *l = (p->line >= 1 && p->line <= p->num_lines)
+		? &p->lines[p->line-1] : 0;
+	if(!l || t < l->tokens || t >= l->tokens+l->length) {
+		int line = targetLine(p, *t);
+		syntaxAssert(p, line >= 0);
+		return line;
+	}
+	if(!l->targets)
+		l->targets = calloc(l->length, sizeof(int));
+	int *c = &l->targets[t-l->tokens];
+	if(!*c) {
+		int line = targetLine(p, *t);
+		syntaxAssert(p, line >= 0);
+		*c = line+1;
+	}
+	return *c-1;
+}
+
+Line newLine(const char *text, int len) {
+	Line l = (Line){malloc(len+1), 0, 0, false, 0, 0, false, 0, false, 0};
+	memcpy(l.text, text, len);
+	l.text[len] = 0;
+	return l;
+}
+
+/* the number for a line added after the last one */
+int nextNumber(Program *p) {
+	return (p->num_lines) ? p->lines[p->num_lines-1].number+1 : 1;
+}
+
+void addLine(Program *p, const char *text, int len) {
+	Line l = newLine(text, len);
+	l.number = nextNumber(p);
+	p->lines = realloc(p->lines, sizeof(Line)*(++(p->num_lines)));
+	p->lines[p->num_lines-1] = l;
+}
+
+/* lines are kept in order of their numbers. returns the index of the
+ * line numbered number, or -1-index for where it would go */
+int findLine(Program *p, int number) {
+	int lo = 0, hi = p->num_lines;
+	while(lo < hi) {
+		int mid = (lo+hi)/2;
+		if(p->lines[mid].number < number)
+			lo = mid+1;
+		else
+			hi = mid;
+	}
+	if(lo < p->num_lines && p->lines[lo].number == number)
+		return lo;
+	return -1-lo;
+}
+
+/* the number errors and LIST show for a line counted from 1 */
+int lineNumber(Program *p, int line) {
+	if(line < 1 || line > p->num_lines)
+		return line;
+	return p->lines[line-1].number;
+}
+
+Function *getFunction(Program *p, char *identifier) {
+	for(int i = 0; i < p->num_functions; i++)
+		if(strcmp(p->functions[i].identifier, identifier) == 0)
+			return &p->functions[i];
+	return 0;
+}
+
+void addLocal(Function *f, char *identifier) {
+	for(int i = 0; i < f->num_locals; i++)
+		if(strcmp(f->locals[i], identifier) == 0)
+			return;
+	f->locals = realloc(f->locals, sizeof(char*)*(++(f->num_locals)));
+	f->locals[f->num_locals-1] = identifier;
+}
+
+/* DEF name(params) = expression
+ * FUNCTION name(params) ... END FUNCTION
+ * SUB name(params) ... END SUB */
+void collectFunctions(Program *p) {
+	for(int l = 0; l < p->num_lines; l++) {
+		char w[10];
+		firstWord(&p->lines[l], w, sizeof(w));
+		if(strcmp(w, "DEF") != 0 && strcmp(w, "FUNCTION") != 0
+				&& strcmp(w, "SUB") != 0)
+			continue;
+
+		Token *tokens = getLine(p, l)->tokens;
+		int n = p->lines[l].length;
+		if(n < 2 || !(isKeyword(tokens[0], KW_DEF)
+				|| isKeyword(tokens[0], KW_FUNCTION)
+				|| isKeyword(tokens[0], KW_SUB)))
+			continue;
+
+		p->line = l+1;
+		syntaxAssert(p, tokens[1].type == SYMBOL);
+		if(getFunction(p, tokens[1].val.s)) {
+			runError(p, "FUNCTION %s DEFINED TWICE\n", tokens[1].val.s);
+		}
+
+		/* in the table straight away, so a bad definition's locals
+		 * are freed with the program */
+		p->functions = realloc(p->functions,
+				sizeof(Function)*(++(p->num_functions)));
+		Function *f = &p->functions[p->num_functions-1];
+		*f = (Function){tokens[1].val.s, 0, 0, 0, l+1, l+1, 0,
+			isKeyword(tokens[0], KW_DEF)};
+
+		int i = 2;
+		if(i < n && isKeyword(tokens[i], KW_LPAREN)) {
+			for(i++; i < n && tokens[i].type == SYMBOL; i++) {
+				addLocal(f, tokens[i].val.s);
+				if(++i >= n || tokens[i].type != COMMA)
+					break;
+			}
+			syntaxAssert(p, i < n && isKeyword(tokens[i], KW_RPAREN));
+			i++;
+		}
+		f->num_params = f->num_locals;
+
+		if(f->def) {
+			syntaxAssert(p, i < n-1 && isKeyword(tokens[i], KW_EQ));
+			f->expression = i+1;
+		}
+		else {
+			if(isKeyword(tokens[0], KW_FUNCTION))
+				addLocal(f, f->identifier);
+			syntaxAssert(p, i == n);
+
+			int end = tokens[0].val.i;
+			bool found = false;
+			for(l++; l < p->num_lines && !found; l++) {
+				Token *t = getLine(p, l)->tokens;
+				int m = p->lines[l].length;
+				if(m == 2 && isKeyword(t[0], KW_END)
+						&& isKeyword(t[1], end)) {
+					found = true;
+					break;
+				}
+
+				/* assignments make locals */
+				for(int j = 0; j < m-1; j++)
+					if(t[j].type == SYMBOL
+							&& isKeyword(t[j+1], KW_EQ)
+							&& (j == 0 || t[j-1].type == COLON
+							|| isKeyword(t[j-1], KW_THEN)
+							|| isKeyword(t[j-1], KW_ELSE)
+							|| isKeyword(t[j-1], KW_FOR)))
+						addLocal(f, t[j].val.s);
+			}
+			if(!found) {
+				runError(p, "EXPECT END %s\n", keywords[end]);
+			}
+			f->end = l+1;
+		}
+	}
+	p->line = 0;
+}
+
+/* rebuilds labels and functions, which only needs the lines that
+ * start with a label or a function keyword to be tokenized */
+void indexProgram(Program *p) {
+	for(int i = 0; i < p->num_functions; i++)
+		free(p->functions[i].locals);
+	p->num_functions = 0;
+	p->num_labels = 0;
+
+	for(int i = 0; i < p->num_lines; i++) {
+		free(p->lines[i].targets);
+		p->lines[i].targets = 0;
+	}
+	for(int i = 0; i < p->num_lines; i++) {
+		char w[64];
+		firstWord(&p->lines[i], w, sizeof(w));
+		if(!w[0] || w[strlen(w)-1] != ':')
+			continue;
+		Line *l = getLine(p, i);
+		if(l->length && l->tokens[0].type == LABEL)
+			addLabel(p, l->tokens[0].val.s, i+1);
+	}
+
+	collectFunctions(p);
+}
+
+void loadString(Program *p, char *text) {
+	while(*text) {
+		char *e = strchr(text, '\n');
+		int len = (e) ? (int)(e-text) : (int)strlen(text);
+		addLine(p, text, len);
+		text += len;
+		if(*text)
+			text++;
+	}
+	indexProgram(p);
+}
+
+/* replaces the line with that number, or puts a new one where the
+ * number belongs. only the changed line is tokenized again */
+void setLine(Program *p, int number, const char *text) {
+	int i = findLine(p, number);
+	if(i >= 0)
+		freeLine(&p->lines[i]);
+	else {
+		i = -1-i;
+		p->lines = realloc(p->lines, sizeof(Line)*(++(p->num_lines)));
+		memmove(&p->lines[i+1], &p->lines[i],
+				sizeof(Line)*(p->num_lines-1-i));
+	}
+	p->lines[i] = newLine(text, strlen(text));
+	p->lines[i].number = number;
+	indexProgram(p);
+}
+
+/* puts a line before the one with that number, moving that line and
+ * any numbered straight after it up by one */
+void insertLine(Program *p, int number, const char *text) {
+	int i = findLine(p, number);
+	for(int n = number; i >= 0 && i < p->num_lines
+			&& p->lines[i].number == n; i++, n++)
+		p->lines[i].number++;
+	setLine(p, number, text);
+}
+
+void deleteLine(Program *p, int line) {
+	freeLine(&p->lines[line-1]);
+	memmove(&p->lines[line-1], &p->lines[line],
+			sizeof(Line)*(p->num_lines-line));
+	p->num_lines--;
+	indexProgram(p);
+}
+
+/* reads a line without its newline, or returns 0 at the end of input */
+char *readLine(FILE *fp) {
+	int len = 0;
 	int max = 30;
 	char *s = malloc(max);
-	int len = 0;
-	for(scanf("%c", &s[len++]); s[len-1] != '\n'; scanf("%c", &s[len++]))
-		if(len > max-10) {
-			max += 20;
-			s = realloc(s, max);
-		}
-	s[len-1] = 0;
+	s[0] = 0;
+	int c;
+	while((c = fgetc(fp)) != EOF && c != '\n')
+		s = addChar(s, &len, &max, c);
+	if(c == EOF && !len) {
+		free(s);
+		return 0;
+	}
 	return s;
 }
 
-void loadFile(Program *p, const char *filename) {
-	FILE *fp = fopen(filename, "r");
-	if(!fp) {
-		printf("failed to open %s\n", filename);
-		freeProgram(p);
-		exit(1);
+/* --record writes a trace of the run and --replay runs the program
+ * again from one. after a header come one byte tags: J and the line a
+ * jump went to, T or F for each IF, and I with a line of INPUT. numbers
+ * are varints. a replay takes its INPUT from the trace, and stops as
+ * soon as the run no longer matches it */
+
+void putVarint(FILE *fp, unsigned n) {
+	while(n >= 0x80) {
+		fputc((n & 0x7f) | 0x80, fp);
+		n >>= 7;
+	}
+	fputc(n, fp);
+}
+
+unsigned takeVarint(FILE *fp) {
+	unsigned n = 0;
+	for(int shift = 0; shift < 32; shift += 7) {
+		int c = fgetc(fp);
+		if(c == EOF)
+			break;
+		n |= (unsigned)(c & 0x7f) << shift;
+		if(!(c & 0x80))
+			break;
+	}
+	return n;
+}
+
+void endOfTrace(Program *p) {
+	fprintf(p->errors, "END OF TRACE AT LINE %d\n", p->line);
+	stopProgram(p, RUN_ERROR);
+}
+
+void traceEvent(Program *p, int tag, unsigned n) {
+	if(!p->replay) {
+		fputc(tag, p->trace);
+		if(tag == 'J')
+			putVarint(p->trace, n);
+		return;
+	}
+	int c = fgetc(p->trace);
+	if(c == EOF)
+		endOfTrace(p);
+	unsigned m = (tag == 'J') ? takeVarint(p->trace) : n;
+	if(feof(p->trace))
+		endOfTrace(p);
+	if(c != tag || m != n) {
+		fprintf(p->errors, "REPLAY DIVERGED AT LINE %d\n", p->line);
+		stopProgram(p, RUN_ERROR);
+	}
+}
+
+/* records s, or when replaying ignores it and returns the next line of
+ * INPUT from the trace */
+char *traceInput(Program *p, char *s) {
+	traceEvent(p, 'I', 0);
+	if(!p->replay) {
+		putVarint(p->trace, strlen(s));
+		fputs(s, p->trace);
+		/* a trace that is cut short still has every INPUT before it */
+		fflush(p->trace);
+		return s;
+	}
+
+	unsigned len = takeVarint(p->trace);
+	if(feof(p->trace))
+		endOfTrace(p);
+	s = malloc(len+1);
+	if(fread(s, 1, len, p->trace) != len) {
+		free(s);
+		endOfTrace(p);
+	}
+	s[len] = 0;
+	return s;
+}
+
+/* INPUT reads a line from stdin. a host that set p->async_input gets
+ * RUN_INPUT back instead, and once it has called provideInput the
+ * statement that asked runs again and takes the line. inside a function
+ * the C stack can't be left, so that still blocks */
+char *getInput(Program *p) {
+	char *s;
+	if(p->trace && p->replay) {
+		fputc('?', p->out);
+		return traceInput(p, 0);
+	}
+	if(p->async_input && !p->num_frames) {
+		if(!p->input) {
+			fputc('?', p->out);
+			p->resume = p->statement;
+			p->resume_n = p->statement_n;
+			stopProgram(p, RUN_INPUT);
+		}
+		s = p->input;
+		p->input = 0;
+	}
+	else {
+		fputc('?', p->out);
+		fflush(p->out);
+		s = readLine(stdin);
+		if(!s) {
+			s = malloc(1);
+			s[0] = 0;
+		}
+	}
+	return (p->trace) ? traceInput(p, s) : s;
+}
+
+void provideInput(Program *p, const char *s) {
+	free(p->input);
+	p->input = malloc(strlen(s)+1);
+	strcpy(p->input, s);
+}
+
+/* locale-free, false unless the whole string is one integer */
+bool parseInteger(const char *s, int *d) {
+	while(*s == ' ' || *s == '\t')
+		s++;
+	bool neg = *s == '-';
+	if(*s == '-' || *s == '+')
+		s++;
+	if(*s < '0' || *s > '9')
+		return false;
+
+	long long n = 0;
+	for(; *s >= '0' && *s <= '9'; s++)
+		if((n = n*10 + *s - '0') > 2147483648ll)
+			return false;
+	while(*s == ' ' || *s == '\t' || *s == '\r')
+		s++;
+	if(*s || (!neg && n > 2147483647ll))
+		return false;
+
+	*d = (neg) ? -n : n;
+	return true;
+}
+
+/* asks again until a number is typed, 0 at the end of input */
+int getInteger(Program *p) {
+	for(;;) {
+		char *s = getInput(p);
+		int d;
+		bool ok = parseInteger(s, &d);
+		free(s);
+		if(ok)
+			return d;
+		if(!p->async_input && feof(stdin))
+			return 0;
+		fprintf(p->out, "NOT A NUMBER\n");
 	}
+}
+
+/* the whole file as a string, or 0 if it can't be opened */
+char *readFile(const char *filename) {
+	FILE *fp = fopen(filename, "r");
+	if(!fp)
+		return 0;
 
 	int len = 0;
 	int max = 200;
@@ -567,7 +1846,16 @@ void loadFile(Program *p, const char *filename) {
 		}
 	}
 	fclose(fp);
+	return s;
+}
 
+void loadFile(Program *p, const char *filename) {
+	char *s = readFile(filename);
+	if(!s) {
+		printf("failed to open %s\n", filename);
+		freeProgram(p);
+		exit(1);
+	}
 	loadString(p, s);
 	free(s);
 }
@@ -584,7 +1872,7 @@ void printDebug(Token t) {
 		printf("%s ", t.val.s);
 		break;
 	case KEYWORD:
-		printf("[%s] ", t.val.cs);
+		printf("[%s] ", keywords[t.val.i]);
 		break;
 	case INTEGER:
 		printf("%d ", t.val.i);
@@ -601,646 +1889,4638 @@ void printDebug(Token t) {
 	}
 }
 
-void printToken(Token t) {
-	switch(t.type) {
-	case NEWLINE:
-		printf("\n");
-		break;
-	case STRING:
-		printf("%s", t.val.s);
-		break;
-	case INTEGER:
-		printf("%d", t.val.i);
-		break;
+const char digitPairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+/* writes d backwards from end, two digits at a time, and returns where
+ * it starts */
+char *formatInteger(char *end, int d) {
+	unsigned u = (d < 0) ? -(unsigned)d : (unsigned)d;
+	char *s = end;
+	while(u >= 100) {
+		int r = u%100*2;
+		u /= 100;
+		*--s = digitPairs[r+1];
+		*--s = digitPairs[r];
+	}
+	if(u >= 10) {
+		*--s = digitPairs[u*2+1];
+		*--s = digitPairs[u*2];
 	}
+	else
+		*--s = '0'+u;
+	if(d < 0)
+		*--s = '-';
+	return s;
+}
+
+void writeValue(FILE *fp, Value v) {
+	char buf[12];
+
+	if(!isInteger(v)) {
+		fputs(valueString(v), fp);
+		return;
+	}
+	char *s = formatInteger(buf+sizeof(buf), valueInteger(v));
+	fwrite(s, 1, buf+sizeof(buf)-s, fp);
 }
 
 void printProgram(Program *p) {
-	for(int i = 0; i < p->num_tokens; i++) {
-		printDebug(p->tokens[i]);
+	for(int i = 0; i < p->num_lines; i++) {
+		Line *l = getLine(p, i);
+		for(int j = 0; j < l->length; j++)
+			printDebug(l->tokens[j]);
+		printf("\n");
 	}
 	printf("\n");
 }
 
-void checkOperator(Token *tokens, int n, const char *s,
-		Token **operands, int *num_operands,
-		Token **operators, int *num_operators)
-{
-	int depth = 0;
+/* strings count as their length where a number is wanted */
+int toInteger(Value v) {
+	if(!isInteger(v))
+		return strlen(valueString(v));
+	return valueInteger(v);
+}
 
-	for(int i = 0; i < n; i++) {
-		if(tokens[i].type != KEYWORD)
-			continue;
+int expectInteger(Program *p, Value v) {
+	syntaxAssert(p, isInteger(v));
+	return valueInteger(v);
+}
 
-		if(strcmp(tokens[i].val.cs, "(") == 0)
-			depth++;
-		else if(strcmp(tokens[i].val.cs, ")") == 0)
-			depth--;
-		if(depth)
-			continue;
+char *expectString(Program *p, Value v) {
+	syntaxAssert(p, !isInteger(v));
+	return valueString(v);
+}
 
-		if(strcmp(tokens[i].val.s, s) == 0) {
-			*num_operators += 1;
-			*operators = realloc(*operators,
-					sizeof(Token)*(*num_operators));
+/* precedence of a binary operator token: 0 for comparisons, 1 for + -,
+ * 2 for * / MOD, -1 if it isn't one */
+int operatorLevel(Token t) {
+	if(t.type != KEYWORD)
+		return -1;
+	switch(t.val.i) {
+	case KW_EQ:
+	case KW_NE:
+	case KW_LT:
+	case KW_GT:
+	case KW_LE:
+	case KW_GE:
+		return 0;
+	case KW_PLUS:
+	case KW_MINUS:
+		return 1;
+	case KW_TIMES:
+	case KW_DIVIDE:
+	case KW_MOD:
+		return 2;
+	}
+	return -1;
+}
 
-			(*operators)[(*num_operators)-1] = tokens[i];
+bool isComparison(int op) {
+	return operatorLevel((Token){KEYWORD, {.i = op}}) == 0;
+}
 
-			if(tokens[i-1].type != KEYWORD) {
-				*num_operands += 1;
-				*operands = realloc(*operands,
-						sizeof(Token)*(*num_operands));
-				(*operands)[(*num_operands)-1] = tokens[i-1];
-			}
-			if(tokens[i+1].type != KEYWORD) {
-				*num_operands += 1;
-				*operands = realloc(*operands,
-						sizeof(Token)*(*num_operands));
-				(*operands)[(*num_operands)-1] = tokens[i+1];
-			}
+/* i2 isn't 0. INT_MIN MOD -1 would trap like the division does */
+int modulo(int i1, int i2) {
+	return (i2 == -1) ? 0 : i1 % i2;
+}
+
+/* n isn't negative. shifts work on the bits, so SHR doesn't copy the
+ * sign and shifting 32 or more leaves nothing */
+int shiftBits(int i, int n, bool left) {
+	if(n >= 32)
+		return 0;
+	return (left) ? (unsigned)i << n : (unsigned)i >> n;
+}
 
-			Token t;
-			t.type = KEYWORD;
-			t.val.cs = "(";
-			tokens[i-1] = t;
-			t.val.cs = ")";
-			tokens[i+1] = t;
+/* i isn't negative. the root a bit at a time, without floating point */
+int squareRoot(int i) {
+	unsigned x = i, r = 0, bit = 1u << 30;
+	while(bit > x)
+		bit >>= 2;
+	for(; bit; bit >>= 2) {
+		if(x >= r+bit) {
+			x -= r+bit;
+			r = (r >> 1)+bit;
 		}
+		else
+			r >>= 1;
 	}
+	return r;
 }
 
-void checkOperators(Token *tokens, int n,
-		Token **operands, int *num_operands,
-		Token **operators, int *num_operators)
-{
-	checkOperator(tokens, n, "/", operands, num_operands,
-			operators, num_operators);
-	checkOperator(tokens, n, "*", operands, num_operands,
-			operators, num_operators);
-	checkOperator(tokens, n, "+", operands, num_operands,
-			operators, num_operators);
-	checkOperator(tokens, n, "-", operands, num_operands,
-			operators, num_operators);
-	checkOperator(tokens, n, "=", operands, num_operands,
-			operators, num_operators);
-	checkOperator(tokens, n, "AND", operands, num_operands,
-			operators, num_operators);
-	checkOperator(tokens, n, "OR", operands, num_operands,
-			operators, num_operators);
-}
-
-Token doOp(Program *p, Token t1, Token t2, const char *s) {
-	Token t;
-	t.type = INTEGER;
+/* RANDOMIZE n turns any n, 0 too, into a xorshift state, which can't be
+ * 0. the C programs --emit-c writes do the same so they draw the same
+ * numbers */
+uint64_t mixSeed(int n) {
+	uint64_t z = (unsigned)n+0x9E3779B97F4A7C15u;
+	z = (z ^ (z >> 30))*0xBF58476D1CE4E5B9u;
+	z = (z ^ (z >> 27))*0x94D049BB133111EBu;
+	z ^= z >> 31;
+	return (z) ? z : 1;
+}
+
+/* RND(n) is from 0 to n-1, from xorshift64*. without RANDOMIZE every
+ * run draws the same numbers, which keeps traces and snapshots whole */
+int randomInteger(Program *p, int n) {
+	if(!p->seed)
+		p->seed = mixSeed(0);
+	uint64_t x = p->seed;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	p->seed = x;
+	return ((x*0x2545F4914F6CDD1Du >> 32)*n) >> 32;
+}
+
+/* how many arguments a math function takes, MIN and MAX taking any
+ * number from 2. 0 if kw isn't one */
+int mathArity(int kw) {
+	switch(kw) {
+	case KW_ABS:
+	case KW_SQR:
+	case KW_RND:
+		return 1;
+	case KW_SHL:
+	case KW_SHR:
+	case KW_MIN:
+	case KW_MAX:
+		return 2;
+	}
+	return 0;
+}
 
-	syntaxAssert(p, t1.type == INTEGER || t1.type == STRING);
-	syntaxAssert(p, t2.type == INTEGER || t2.type == STRING);
+int mathFunction(Program *p, int kw, int a, int b) {
+	switch(kw) {
+	case KW_ABS:
+		return (a < 0) ? (int)-(unsigned)a : a;
+	case KW_MIN:
+		return (a < b) ? a : b;
+	case KW_MAX:
+		return (a > b) ? a : b;
+	}
+
+	if((kw == KW_SQR && a < 0) || (kw == KW_RND && a <= 0)
+			|| ((kw == KW_SHL || kw == KW_SHR) && b < 0)) {
+		runError(p, "INVALID ARGUMENT TO %s\n", keywords[kw]);
+	}
+	if(kw == KW_SQR)
+		return squareRoot(a);
+	if(kw == KW_RND)
+		return randomInteger(p, a);
+	return shiftBits(a, b, kw == KW_SHL);
+}
 
-	if(strcmp(s, "=") == 0) {
-		if(t1.type == STRING && t2.type == INTEGER) {
-			t1.type = INTEGER;
-			t1.val.i = strlen(t1.val.s);
+Value doOp(Program *p, Value v1, Value v2, int op) {
+	int r;
+
+	if(isComparison(op)) {
+		int c;
+		if(!isInteger(v1) && !isInteger(v2))
+			c = strcmp(valueString(v1), valueString(v2));
+		else {
+			int i1 = toInteger(v1), i2 = toInteger(v2);
+			c = (i1 > i2) - (i1 < i2);
 		}
-		if(t1.type == INTEGER && t2.type == STRING) {
-			t2.type = INTEGER;
-			t2.val.i = strlen(t2.val.s);
+
+		switch(op) {
+		case KW_EQ:
+			r = (c == 0);
+			break;
+		case KW_NE:
+			r = (c != 0);
+			break;
+		case KW_LT:
+			r = (c < 0);
+			break;
+		case KW_GT:
+			r = (c > 0);
+			break;
+		case KW_LE:
+			r = (c <= 0);
+			break;
+		default:
+			r = (c >= 0);
+			break;
 		}
 
-		if(t1.type == STRING)
-			t.val.i = (strcmp(t1.val.s, t2.val.s) == 0);
-		else
-			t.val.i = (t1.val.i == t2.val.i);
+		return integerValue(r);
+	}
 
-		return t;
+	int i1 = toInteger(v1), i2 = toInteger(v2);
+
+	switch(op) {
+	/* unsigned so overflow wraps instead of being undefined */
+	case KW_PLUS:
+		r = (unsigned)i1 + i2;
+		break;
+	case KW_MINUS:
+		r = (unsigned)i1 - i2;
+		break;
+	case KW_DIVIDE:
+		if(i2 == 0) {
+			runError(p, "DIVISION BY ZERO\n");
+		}
+		/* INT_MIN / -1 would trap */
+		r = (i2 == -1) ? (int)-(unsigned)i1 : i1 / i2;
+		break;
+	case KW_MOD:
+		if(i2 == 0) {
+			runError(p, "DIVISION BY ZERO\n");
+		}
+		r = modulo(i1, i2);
+		break;
+	case KW_TIMES:
+		r = (unsigned)i1 * i2;
+		break;
+	default:
+		runError(p, "UNKNOWN OPERATOR\n");
 	}
 
-	if(t1.type == STRING) {
-		t1.type = INTEGER;
-		t1.val.i = strlen(t1.val.s);
+	return integerValue(r);
+}
+
+void addTemp(Program *p, char *s) {
+	p->temps[p->num_temps++] = (Temp){s, p->num_frames};
+	if(p->num_temps > p->max_temps-10) {
+		p->max_temps += 20;
+		p->temps = realloc(p->temps, p->max_temps*sizeof(Temp));
 	}
-	if(t2.type == STRING) {
-		t2.type = INTEGER;
-		t2.val.i = strlen(t2.val.s);
+}
+
+/* strings returned by functions live until the statement that made
+ * them finishes */
+void releaseTemps(Program *p) {
+	while(p->num_temps && p->temps[p->num_temps-1].depth >= p->num_frames)
+		free(p->temps[--(p->num_temps)].s);
+}
+
+void pushFrame(Program *p, Frame f) {
+	p->frames[p->num_frames++] = f;
+	if(p->num_frames > p->max_frames-10) {
+		useMemory(p, 20*sizeof(Frame));
+		p->max_frames += 20;
+		p->frames = realloc(p->frames, p->max_frames*sizeof(Frame));
 	}
+}
 
-	syntaxAssert(p, t1.type == INTEGER && t2.type == INTEGER);
+Value evalExpression(Program *p, Token *tokens, int n);
+void runLines(Program *p);
+int checkLines(Program *p, int from, int to);
 
-	if(strcmp(s, "+") == 0)
-		t.val.i = t1.val.i + t2.val.i;
-	else if(strcmp(s, "-") == 0)
-		t.val.i = t1.val.i - t2.val.i;
-	else if(strcmp(s, "/") == 0)
-		t.val.i = t1.val.i / t2.val.i;
-	else if(strcmp(s, "*") == 0)
-		t.val.i = t1.val.i * t2.val.i;
-	else if(strcmp(s, "AND") == 0)
-		t.val.i = t1.val.i & t2.val.i;
-	else if(strcmp(s, "OR") == 0)
-		t.val.i = t1.val.i | t2.val.i;
+Value callFunction(Program *p, Function *f, Value *args, int num_args) {
+	if(num_args != f->num_params) {
+		runError(p, "WRONG NUMBER OF ARGUMENTS TO %s\n", f->identifier);
+	}
+	checkBudgets(p);
+	/* deep recursion would overflow the C stack first */
+	if(p->num_frames >= MAX_CALLS) {
+		runError(p, "TOO MANY NESTED CALLS TO %s\n", f->identifier);
+	}
+	/* arguments are checked first so nothing leaks on a mismatch */
+	for(int i = 0; i < num_args; i++)
+		if(isStringName(f->locals[i]))
+			expectString(p, args[i]);
+		else
+			expectInteger(p, args[i]);
+
+	Frame fr = (Frame){f, allocate(p, sizeof(Variable)*f->num_locals),
+		p->num_returnLines, p->num_forLoops, false};
+	for(int i = 0; i < f->num_locals; i++) {
+		Variable *v = &fr.slots[i];
+		v->identifier = f->locals[i];
+		if(isStringName(v->identifier))
+			v->val.s = copyString(p, (i < num_args)
+					? valueString(args[i]) : p->blank);
+		else
+			v->val.i = (i < num_args) ? valueInteger(args[i]) : 0;
+	}
+	pushFrame(p, fr);
+
+	int line = p->line;
+	bool do_else = p->do_else;
+	Value r;
+
+	if(f->def) {
+		Line *l = getLine(p, f->line-1);
+		if(!l->checked && checkLines(p, f->line-1, f->line))
+			stopProgram(p, RUN_ERROR);
+		r = evalExpression(p, l->tokens+f->expression,
+				l->length-f->expression);
+	}
 	else {
-		printf("UNKNOWN OPERATOR\n");
-		syntaxError(p);
+		p->line = f->line;
+		runLines(p);
+
+		Variable *v = getLocal(p, f->identifier);
+		r = integerValue(0);
+		if(v && isStringName(f->identifier))
+			r = stringValue(v->val.s);
+		else if(v)
+			r = integerValue(v->val.i);
 	}
 
-	return t;
-}
-
-Token *getVariables(Program *p, Token *tokens, int *n);
+	if(!isInteger(r)) {
+		char *s = malloc(strlen(valueString(r))+1);
+		strcpy(s, valueString(r));
+		r = stringValue(s);
+	}
 
-Token evalExpression(Program *p, Token *otokens, int n) {
-	Token *tokens = malloc(sizeof(Token)*n);
-	for(int i = 0; i < n; i++)
-		tokens[i] = otokens[i];
+	releaseTemps(p);
+	freeFrame(p, &p->frames[--(p->num_frames)]);
+	p->num_returnLines = fr.returnDepth;
+	p->num_forLoops = fr.forDepth;
+	p->line = line;
+	p->do_else = do_else;
 
-	tokens = getVariables(p, tokens, &n);
+	if(!isInteger(r))
+		addTemp(p, valueString(r));
+	return r;
+}
 
-	/* if only 1 part, return */
-	if(n == 1) {
-		Token r = *tokens;
-		free(tokens);
-		return r;
+/* file numbers run from 1 to MAX_FILES */
+FILE *getFile(Program *p, int n) {
+	if(n < 1 || n > MAX_FILES) {
+		runError(p, "INVALID FILE NUMBER %d\n", n);
 	}
+	if(!p->files[n-1]) {
+		runError(p, "FILE %d IS NOT OPEN\n", n);
+	}
+	return p->files[n-1];
+}
 
-	/* convert to rpn in two seperate arrays */
+/* recursive descent evaluator, lowest precedence first:
+ * OR, AND, NOT, comparisons, + -, * / MOD, unary -, primaries.
+ * with skip set the tokens are parsed but nothing is looked up or
+ * computed, which is how AND and OR short-circuit */
 
-	int depth = 0, bopen_max = 20;
-	int *bopen = malloc(sizeof(int)*bopen_max);
+Value evalOr(Program *p, Token *tokens, int n, int *i, bool skip);
 
-	Token *operands = 0;
-	int num_operands = 0;
-	Token *operators = 0;
-	int num_operators = 0;
+Value evalPrimary(Program *p, Token *tokens, int n, int *i, bool skip) {
+	syntaxAssert(p, *i < n);
+	Token t = tokens[(*i)++];
 
-	for(int i = 0; i < n; i++) {
-		if(tokens[i].type != KEYWORD)
-			continue;
+	if(t.type == INTEGER)
+		return integerValue(t.val.i);
+	if(t.type == STRING)
+		return stringValue(t.val.s);
+
+	if(isKeyword(t, KW_LPAREN)) {
+		Value v = evalOr(p, tokens, n, i, skip);
+		syntaxAssert(p, *i < n && isKeyword(tokens[*i], KW_RPAREN));
+		(*i)++;
+		return v;
+	}
+
+	/* EOF(n) is true once file n has nothing left to read */
+	if(isKeyword(t, KW_EOF)) {
+		syntaxAssert(p, *i < n && isKeyword(tokens[(*i)++], KW_LPAREN));
+		Value v = evalOr(p, tokens, n, i, skip);
+		syntaxAssert(p, *i < n && isKeyword(tokens[(*i)++], KW_RPAREN));
+		int f = expectInteger(p, v);
+		if(skip)
+			return v;
+		FILE *fp = getFile(p, f);
+		int c = fgetc(fp);
+		if(c != EOF)
+			ungetc(c, fp);
+		return integerValue(c == EOF);
+	}
 
-		if(strcmp(tokens[i].val.cs, "(") == 0)
-			bopen[depth++] = i;
-		else if(strcmp(tokens[i].val.cs, ")") == 0) {
-			int open = bopen[--depth];
-			Token *tkns = tokens+open+1;
-			int n = i-open-1;
-			checkOperators(tkns, n, &operands, &num_operands,
-					&operators, &num_operators);
+	/* COUNT(m), HAS(m, key) and KEY(m, i) on maps */
+	if(isKeyword(t, KW_COUNT) || isKeyword(t, KW_HAS)
+			|| isKeyword(t, KW_KEY)) {
+		int kw = t.val.i;
+		syntaxAssert(p, *i+1 < n && isKeyword(tokens[(*i)++], KW_LPAREN));
+		syntaxAssert(p, tokens[*i].type == SYMBOL);
+		char *identifier = tokens[(*i)++].val.s;
+		Value a = integerValue(0);
+		if(kw != KW_COUNT) {
+			syntaxAssert(p, *i < n && tokens[(*i)++].type == COMMA);
+			a = evalOr(p, tokens, n, i, skip);
 		}
+		syntaxAssert(p, *i < n && isKeyword(tokens[(*i)++], KW_RPAREN));
+		if(skip)
+			return integerValue(0);
 
-		if(depth > bopen_max-10) {
-			bopen_max += 20;
-			bopen = realloc(bopen, sizeof(int)*bopen_max);
+		Map *m = getMap(p, identifier);
+		if(!m) {
+			runError(p, "COULD NOT FIND %s\n", identifier);
+		}
+		if(kw == KW_COUNT)
+			return integerValue(m->num_entries);
+		if(kw == KW_HAS)
+			return integerValue(findEntry(m, a) != 0);
+		int k = expectInteger(p, a);
+		if(k < 1 || k > m->num_entries) {
+			runError(p, "INVALID INDEX %d\n", k);
 		}
+		return m->entries[k-1].key;
 	}
-	checkOperators(tokens, n, &operands, &num_operands,
-			&operators, &num_operators);
 
-	/* we have operators in rpn, apply operations */
-
-	for(int i = 0; i < num_operators; i++) {
-		operands[0] = doOp(p, operands[0], operands[1],
-				operators[i].val.cs);
-		num_operands--;
-		for(int j = 1; j < num_operands; j++)
-			operands[j] = operands[j+1];
+	/* ABS(x), SQR(x), RND(n), SHL(x, n), SHR(x, n), MIN(x, y, ...) and
+	 * MAX(x, y, ...) */
+	if(t.type == KEYWORD && mathArity(t.val.i)) {
+		int kw = t.val.i;
+		bool variadic = kw == KW_MIN || kw == KW_MAX;
+		int args[2] = {0, 0};
+		int num_args = 0;
+		syntaxAssert(p, *i < n && isKeyword(tokens[(*i)++], KW_LPAREN));
+		for(;;) {
+			Value v = evalOr(p, tokens, n, i, skip);
+			int a = (skip) ? 0 : expectInteger(p, v);
+			/* MIN and MAX fold their arguments as they come */
+			if(variadic && num_args && !skip)
+				args[0] = mathFunction(p, kw, args[0], a);
+			else if(num_args < 2)
+				args[num_args] = a;
+			num_args++;
+			if(*i < n && tokens[*i].type == COMMA)
+				(*i)++;
+			else
+				break;
+		}
+		syntaxAssert(p, *i < n && isKeyword(tokens[(*i)++], KW_RPAREN));
+		if(num_args != mathArity(kw) && !(variadic && num_args > 2)) {
+			runError(p, "WRONG NUMBER OF ARGUMENTS TO %s\n", keywords[kw]);
+		}
+		if(skip || variadic)
+			return integerValue(args[0]);
+		return integerValue(mathFunction(p, kw, args[0], args[1]));
 	}
 
-	syntaxAssert(p, num_operands == 1);
-	Token r = operands[0];
+	syntaxAssert(p, t.type == SYMBOL);
+	bool is_str = isStringName(t.val.s);
+
+	/* function call */
+	Function *f;
+	if(*i < n && isKeyword(tokens[*i], KW_LPAREN)
+			&& (f = getFunction(p, t.val.s))) {
+		(*i)++;
+		/* a temp, so it is freed if the call fails */
+		Value *args = malloc(sizeof(Value)*(f->num_params+1));
+		addTemp(p, (char*)args);
+		int num_args = 0;
+		while(*i < n && !isKeyword(tokens[*i], KW_RPAREN)) {
+			if(num_args > f->num_params) {
+				runError(p, "WRONG NUMBER OF ARGUMENTS TO %s\n",
+						f->identifier);
+			}
+			args[num_args++] = evalOr(p, tokens, n, i, skip);
+			if(*i < n && tokens[*i].type == COMMA)
+				(*i)++;
+			else
+				break;
+		}
+		syntaxAssert(p, *i < n && isKeyword(tokens[*i], KW_RPAREN));
+		(*i)++;
 
-	free(bopen);
-	free(tokens);
-	free(operands);
-	free(operators);
+		if(!skip)
+			return callFunction(p, f, args, num_args);
+	}
 
-	return r;
+	/* array element */
+	else if(*i < n && isKeyword(tokens[*i], KW_LPAREN)) {
+		(*i)++;
+		Value d = evalOr(p, tokens, n, i, skip);
+		syntaxAssert(p, *i < n && isKeyword(tokens[*i], KW_RPAREN));
+		(*i)++;
+		Map *m = getMap(p, t.val.s);
+		syntaxAssert(p, m || isInteger(d));
+
+		if(skip)
+			;
+		else if(m)
+			return getMapVal(p, m, d);
+		else if(is_str)
+			return stringValue(getStringArrayVal(p, t.val.s,
+					valueInteger(d)));
+		else
+			return integerValue(getIntegerArrayVal(p, t.val.s,
+					valueInteger(d)));
+	}
+	else if(skip)
+		;
+	else if(is_str)
+		return stringValue(getStringVariable(p, t.val.s));
+	else
+		return integerValue(getIntegerVariable(p, t.val.s));
+
+	return (is_str) ? stringValue(p->blank) : integerValue(0);
 }
 
-Token *getVariables(Program *p, Token *tokens, int *n) {
-	Token *ntokens = 0;
-	int nn = 0;
-
-	for(int i = 0; i < *n; i++) {
-		Token t = tokens[i];
-
-		if(tokens[i].type == SYMBOL) {
-			bool is_arr = false;
-			if(i+1 < *n)
-			if(tokens[i+1].type == KEYWORD)
-			if(strcmp(tokens[i+1].val.cs, "(") == 0)
-				is_arr = true;
-
-			if(is_arr) {
-				int found = 0;
-				for(int j = i+1; j < *n && !found; j++)
-					if(tokens[j].type == KEYWORD)
-					if(strcmp(tokens[j].val.cs, ")") == 0)
-						found = j;
-				int sz = found-i-2;
-				syntaxAssert(p, sz > 0);
-				Token d = evalExpression(p, tokens+i+2, sz);
-				syntaxAssert(p, d.type == INTEGER);
-
-				if(tokens[i].val.s[strlen(tokens[i].val.s)-1]
-						== '$') {
-					t.type = STRING;
-					t.val.s = getStringArrayVal(p,
-							tokens[i].val.s,
-							d.val.i);
-				}
-				else {
-					t.type = INTEGER;
-					t.val.i = getIntegerArrayVal(p,
-							tokens[i].val.s,
-							d.val.i);
-				}
-				i = found;
-			}
-			else {
-				bool is_str = false;
-				if(t.val.s[0] != 0)
-					if(t.val.s[strlen(t.val.s)-1]
-							== '$')
-						is_str = true;
-				if(is_str) {
-					t.val.s = getStringVariable(p,
-							t.val.s);
-					t.type = STRING;
-				}
-				else {
-					t.val.i = getIntegerVariable(p,
-							t.val.s);
-					t.type = INTEGER;
-				}
-			}
-		}
-		ntokens = realloc(ntokens, sizeof(Token)*(++nn));
-		ntokens[nn-1] = t;
+Value evalUnary(Program *p, Token *tokens, int n, int *i, bool skip) {
+	if(*i < n && isKeyword(tokens[*i], KW_MINUS)) {
+		(*i)++;
+		Value v = evalUnary(p, tokens, n, i, skip);
+		return integerValue(-(unsigned)toInteger(v));
 	}
+	return evalPrimary(p, tokens, n, i, skip);
+}
 
-	free(tokens);
-	*n = nn;
-	return ntokens;
+Value evalProduct(Program *p, Token *tokens, int n, int *i, bool skip) {
+	Value v = evalUnary(p, tokens, n, i, skip);
+	while(*i < n && (isKeyword(tokens[*i], KW_TIMES)
+			|| isKeyword(tokens[*i], KW_DIVIDE)
+			|| isKeyword(tokens[*i], KW_MOD))) {
+		int op = tokens[(*i)++].val.i;
+		Value v2 = evalUnary(p, tokens, n, i, skip);
+		if(!skip)
+			v = doOp(p, v, v2, op);
+	}
+	return v;
+}
+
+Value evalSum(Program *p, Token *tokens, int n, int *i, bool skip) {
+	Value v = evalProduct(p, tokens, n, i, skip);
+	while(*i < n && (isKeyword(tokens[*i], KW_PLUS)
+			|| isKeyword(tokens[*i], KW_MINUS))) {
+		int op = tokens[(*i)++].val.i;
+		Value v2 = evalProduct(p, tokens, n, i, skip);
+		if(!skip)
+			v = doOp(p, v, v2, op);
+	}
+	return v;
+}
+
+Value evalCompare(Program *p, Token *tokens, int n, int *i, bool skip) {
+	Value v = evalSum(p, tokens, n, i, skip);
+	while(*i < n && tokens[*i].type == KEYWORD
+			&& isComparison(tokens[*i].val.i)) {
+		int op = tokens[(*i)++].val.i;
+		Value v2 = evalSum(p, tokens, n, i, skip);
+		v = (skip) ? integerValue(0) : doOp(p, v, v2, op);
+	}
+	return v;
+}
+
+Value evalNot(Program *p, Token *tokens, int n, int *i, bool skip) {
+	if(*i < n && isKeyword(tokens[*i], KW_NOT)) {
+		(*i)++;
+		Value v = evalNot(p, tokens, n, i, skip);
+		return integerValue(!toInteger(v));
+	}
+	return evalCompare(p, tokens, n, i, skip);
+}
+
+Value evalAnd(Program *p, Token *tokens, int n, int *i, bool skip) {
+	Value v = evalNot(p, tokens, n, i, skip);
+	while(*i < n && isKeyword(tokens[*i], KW_AND)) {
+		(*i)++;
+		bool l = toInteger(v) != 0;
+		Value v2 = evalNot(p, tokens, n, i, skip || !l);
+		v = integerValue(l && toInteger(v2) != 0);
+	}
+	return v;
+}
+
+Value evalOr(Program *p, Token *tokens, int n, int *i, bool skip) {
+	Value v = evalAnd(p, tokens, n, i, skip);
+	while(*i < n && isKeyword(tokens[*i], KW_OR)) {
+		(*i)++;
+		bool l = toInteger(v) != 0;
+		Value v2 = evalAnd(p, tokens, n, i, skip || l);
+		v = integerValue(l || toInteger(v2) != 0);
+	}
+	return v;
+}
+
+Value evalExpression(Program *p, Token *tokens, int n) {
+	int i = 0;
+	Value v = evalOr(p, tokens, n, &i, false);
+	syntaxAssert(p, i == n);
+	return v;
+}
+
+/* compiler for hot lines, enabled with -j. only integer assignments,
+ * alone or after IF ... THEN, are compiled. anything else returns false
+ * and the line stays interpreted */
+
+void emit(Code *c, int op, int push) {
+	c->ops = realloc(c->ops, sizeof(int)*(++(c->num_ops)));
+	c->ops[c->num_ops-1] = op;
+	c->depth += push;
+	if(c->depth > c->max_depth)
+		c->max_depth = c->depth;
+}
+
+int integerIndex(Program *p, char *identifier) {
+	for(int i = 0; i < p->num_integers; i++)
+		if(strcmp(p->integers[i].identifier, identifier) == 0)
+			return i;
+	setIntegerVariable(p, identifier, 0);
+	return p->num_integers-1;
+}
+
+int integerArrayIndex(Program *p, char *identifier) {
+	for(int i = 0; i < p->num_integerArrays; i++)
+		if(strcmp(p->integerArrays[i].identifier, identifier) == 0)
+			return i;
+	return -1;
+}
+
+int compileOp(int kw) {
+	switch(kw) {
+	case KW_PLUS:
+		return OP_ADD;
+	case KW_MINUS:
+		return OP_SUB;
+	case KW_TIMES:
+		return OP_MUL;
+	case KW_DIVIDE:
+		return OP_DIV;
+	case KW_MOD:
+		return OP_MOD;
+	case KW_ABS:
+		return OP_ABS;
+	case KW_SQR:
+		return OP_SQR;
+	case KW_MIN:
+		return OP_MIN;
+	case KW_MAX:
+		return OP_MAX;
+	case KW_SHL:
+		return OP_SHL;
+	case KW_SHR:
+		return OP_SHR;
+	case KW_EQ:
+		return OP_EQ;
+	case KW_NE:
+		return OP_NE;
+	case KW_LT:
+		return OP_LT;
+	case KW_GT:
+		return OP_GT;
+	case KW_LE:
+		return OP_LE;
+	}
+	return OP_GE;
+}
+
+bool compileOr(Program *p, Code *c, Token *tokens, int n, int *i);
+
+bool compilePrimary(Program *p, Code *c, Token *tokens, int n, int *i) {
+	if(*i >= n)
+		return false;
+	Token t = tokens[(*i)++];
+
+	if(t.type == INTEGER) {
+		emit(c, OP_CONST, 1);
+		emit(c, t.val.i, 0);
+		return true;
+	}
+
+	if(isKeyword(t, KW_LPAREN)) {
+		if(!compileOr(p, c, tokens, n, i))
+			return false;
+		return *i < n && isKeyword(tokens[(*i)++], KW_RPAREN);
+	}
+
+	/* math functions but RND, whose seed would move on if the line
+	 * bailed out and was run again */
+	if(t.type == KEYWORD && mathArity(t.val.i) && t.val.i != KW_RND) {
+		int kw = t.val.i;
+		bool variadic = kw == KW_MIN || kw == KW_MAX;
+		int num_args = 0;
+		if(*i >= n || !isKeyword(tokens[(*i)++], KW_LPAREN))
+			return false;
+		for(;;) {
+			if(!compileOr(p, c, tokens, n, i))
+				return false;
+			if(variadic && num_args)
+				emit(c, compileOp(kw), -1);
+			num_args++;
+			if(*i < n && tokens[*i].type == COMMA)
+				(*i)++;
+			else
+				break;
+		}
+		if(num_args != mathArity(kw) && !(variadic && num_args > 2))
+			return false;
+		if(!variadic)
+			emit(c, compileOp(kw), 1-num_args);
+		return *i < n && isKeyword(tokens[(*i)++], KW_RPAREN);
+	}
+
+	if(t.type != SYMBOL || isStringName(t.val.s))
+		return false;
+
+	if(*i < n && isKeyword(tokens[*i], KW_LPAREN)) {
+		int a = integerArrayIndex(p, t.val.s);
+		if(a < 0 || getFunction(p, t.val.s) || getMap(p, t.val.s))
+			return false;
+		(*i)++;
+		if(!compileOr(p, c, tokens, n, i))
+			return false;
+		if(*i >= n || !isKeyword(tokens[(*i)++], KW_RPAREN))
+			return false;
+		emit(c, OP_ARRAY, 0);
+		emit(c, a, 0);
+		return true;
+	}
+
+	emit(c, OP_VAR, 1);
+	emit(c, integerIndex(p, t.val.s), 0);
+	return true;
+}
+
+bool compileUnary(Program *p, Code *c, Token *tokens, int n, int *i) {
+	if(*i < n && isKeyword(tokens[*i], KW_MINUS)) {
+		(*i)++;
+		if(!compileUnary(p, c, tokens, n, i))
+			return false;
+		emit(c, OP_NEG, 0);
+		return true;
+	}
+	return compilePrimary(p, c, tokens, n, i);
+}
+
+/* levels are 0 for comparisons, 1 for + -, 2 for * / */
+bool compileBinary(Program *p, Code *c, Token *tokens, int n, int *i,
+		int level)
+{
+	if(!((level == 2) ? compileUnary(p, c, tokens, n, i)
+			: compileBinary(p, c, tokens, n, i, level+1)))
+		return false;
+
+	while(*i < n && operatorLevel(tokens[*i]) == level) {
+		int op = tokens[(*i)++].val.i;
+
+		if(!((level == 2) ? compileUnary(p, c, tokens, n, i)
+				: compileBinary(p, c, tokens, n, i, level+1)))
+			return false;
+		emit(c, compileOp(op), -1);
+	}
+	return true;
+}
+
+bool compileNot(Program *p, Code *c, Token *tokens, int n, int *i) {
+	if(*i < n && isKeyword(tokens[*i], KW_NOT)) {
+		(*i)++;
+		if(!compileNot(p, c, tokens, n, i))
+			return false;
+		emit(c, OP_NOT, 0);
+		return true;
+	}
+	return compileBinary(p, c, tokens, n, i, 0);
+}
+
+/* AND and OR jump past their right operand when the left decides */
+bool compileLogic(Program *p, Code *c, Token *tokens, int n, int *i,
+		int kw)
+{
+	bool is_and = kw == KW_AND;
+	if(!(is_and ? compileNot(p, c, tokens, n, i)
+			: compileLogic(p, c, tokens, n, i, KW_AND)))
+		return false;
+
+	while(*i < n && isKeyword(tokens[*i], kw)) {
+		(*i)++;
+		emit(c, is_and ? OP_AND : OP_OR, -1);
+		emit(c, 0, 0);
+		int jump = c->num_ops-1;
+		if(!(is_and ? compileNot(p, c, tokens, n, i)
+				: compileLogic(p, c, tokens, n, i, KW_AND)))
+			return false;
+		emit(c, OP_BOOL, 0);
+		c->ops[jump] = c->num_ops;
+	}
+	return true;
+}
+
+bool compileOr(Program *p, Code *c, Token *tokens, int n, int *i) {
+	return compileLogic(p, c, tokens, n, i, KW_OR);
+}
+
+bool compileAssignment(Program *p, Code *c, Token *tokens, int n) {
+	if(n < 3 || tokens[0].type != SYMBOL
+			|| isStringName(tokens[0].val.s))
+		return false;
+	for(int i = 0; i < n; i++)
+		if(tokens[i].type == COLON)
+			return false;
+
+	int i = 2;
+	if(isKeyword(tokens[1], KW_EQ)) {
+		if(!compileOr(p, c, tokens, n, &i) || i != n)
+			return false;
+		emit(c, OP_STORE, -1);
+		emit(c, integerIndex(p, tokens[0].val.s), 0);
+		return true;
+	}
+
+	int a = integerArrayIndex(p, tokens[0].val.s);
+	if(!isKeyword(tokens[1], KW_LPAREN) || a < 0
+			|| getMap(p, tokens[0].val.s))
+		return false;
+	if(!compileOr(p, c, tokens, n, &i) || i >= n-1
+			|| !isKeyword(tokens[i], KW_RPAREN)
+			|| !isKeyword(tokens[i+1], KW_EQ))
+		return false;
+	i += 2;
+	if(!compileOr(p, c, tokens, n, &i) || i != n)
+		return false;
+	emit(c, OP_STOREARRAY, -2);
+	emit(c, a, 0);
+	return true;
+}
+
+/* IF cond THEN assignment, where a false cond jumps past the
+ * assignment */
+bool compileStatement(Program *p, Code *c, Token *tokens, int n) {
+	if(n == 0 || !isKeyword(tokens[0], KW_IF))
+		return compileAssignment(p, c, tokens, n);
+
+	int i = 1;
+	if(!compileOr(p, c, tokens, n, &i) || i >= n
+			|| !isKeyword(tokens[i], KW_THEN))
+		return false;
+	emit(c, OP_IF, -1);
+	emit(c, 0, 0);
+	int jump = c->num_ops-1;
+	if(!compileAssignment(p, c, tokens+i+1, n-i-1))
+		return false;
+	c->ops[jump] = c->num_ops;
+	return true;
+}
+
+Code *compileLine(Program *p, Token *tokens, int n) {
+	Code *c = malloc(sizeof(Code));
+	*c = (Code){0, 0, 0, 0};
+	if(compileStatement(p, c, tokens, n) && c->max_depth <= CODE_STACK)
+		return c;
+	free(c->ops);
+	free(c);
+	return 0;
+}
+
+/* returns false to bail out to the interpreter, which happens before
+ * anything is stored so the line can simply be run again */
+bool runCode(Program *p, Code *c, Variable *integers, bool *do_else) {
+	int stack[CODE_STACK];
+	int sp = 0;
+
+	for(int *op = c->ops; op < c->ops+c->num_ops; op++) {
+		switch(*op) {
+		case OP_CONST:
+			stack[sp++] = *(++op);
+			break;
+		case OP_VAR:
+			stack[sp++] = integers[*(++op)].val.i;
+			break;
+		case OP_ARRAY: {
+			IntegerArray *a = &p->integerArrays[*(++op)];
+			int d = stack[sp-1];
+			if(d < 1 || d > a->num_integers)
+				return false;
+			stack[sp-1] = a->integers[d-1];
+			break;
+		}
+		case OP_NEG:
+			stack[sp-1] = -(unsigned)stack[sp-1];
+			break;
+		case OP_NOT:
+			stack[sp-1] = !stack[sp-1];
+			break;
+		case OP_ABS:
+			if(stack[sp-1] < 0)
+				stack[sp-1] = -(unsigned)stack[sp-1];
+			break;
+		case OP_SQR:
+			if(stack[sp-1] < 0)
+				return false;
+			stack[sp-1] = squareRoot(stack[sp-1]);
+			break;
+		case OP_ADD:
+			sp--;
+			stack[sp-1] = (unsigned)stack[sp-1] + stack[sp];
+			break;
+		case OP_SUB:
+			sp--;
+			stack[sp-1] = (unsigned)stack[sp-1] - stack[sp];
+			break;
+		case OP_MUL:
+			sp--;
+			stack[sp-1] = (unsigned)stack[sp-1] * stack[sp];
+			break;
+		case OP_DIV:
+			sp--;
+			if(stack[sp] == 0)
+				return false;
+			/* INT_MIN / -1 would trap */
+			stack[sp-1] = (stack[sp] == -1)
+				? (int)-(unsigned)stack[sp-1]
+				: stack[sp-1] / stack[sp];
+			break;
+		case OP_MOD:
+			sp--;
+			if(stack[sp] == 0)
+				return false;
+			stack[sp-1] = modulo(stack[sp-1], stack[sp]);
+			break;
+		case OP_MIN:
+			sp--;
+			if(stack[sp] < stack[sp-1])
+				stack[sp-1] = stack[sp];
+			break;
+		case OP_MAX:
+			sp--;
+			if(stack[sp] > stack[sp-1])
+				stack[sp-1] = stack[sp];
+			break;
+		case OP_SHL:
+		case OP_SHR:
+			sp--;
+			if(stack[sp] < 0)
+				return false;
+			stack[sp-1] = shiftBits(stack[sp-1], stack[sp],
+					*op == OP_SHL);
+			break;
+		case OP_EQ:
+			sp--;
+			stack[sp-1] = stack[sp-1] == stack[sp];
+			break;
+		case OP_NE:
+			sp--;
+			stack[sp-1] = stack[sp-1] != stack[sp];
+			break;
+		case OP_LT:
+			sp--;
+			stack[sp-1] = stack[sp-1] < stack[sp];
+			break;
+		case OP_GT:
+			sp--;
+			stack[sp-1] = stack[sp-1] > stack[sp];
+			break;
+		case OP_LE:
+			sp--;
+			stack[sp-1] = stack[sp-1] <= stack[sp];
+			break;
+		case OP_GE:
+			sp--;
+			stack[sp-1] = stack[sp-1] >= stack[sp];
+			break;
+		case OP_AND:
+			op++;
+			if(stack[sp-1] == 0)
+				op = c->ops+*op-1;
+			else
+				sp--;
+			break;
+		case OP_OR:
+			op++;
+			if(stack[sp-1] != 0) {
+				stack[sp-1] = 1;
+				op = c->ops+*op-1;
+			}
+			else
+				sp--;
+			break;
+		case OP_BOOL:
+			stack[sp-1] = stack[sp-1] != 0;
+			break;
+		case OP_STORE:
+			integers[*(++op)].val.i = stack[--sp];
+			break;
+		case OP_STOREARRAY: {
+			IntegerArray *a = &p->integerArrays[*(++op)];
+			int d = stack[sp-2];
+			if(d < 1 || d > a->num_integers)
+				return false;
+			a->integers[d-1] = stack[sp-1];
+			sp -= 2;
+			break;
+		}
+		case OP_IF:
+			op++;
+			*do_else = stack[--sp] == 0;
+			if(*do_else)
+				op = c->ops+*op-1;
+			break;
+		}
+	}
+	return true;
+}
+
+/* counts runs of a line and compiles it once it gets hot. false means
+ * the line still has to be interpreted */
+bool runCompiled(Program *p, Line *l) {
+	if(!l->code) {
+		if(l->count < 0
+				|| (!l->typed && ++(l->count) < JIT_THRESHOLD))
+			return false;
+		l->code = compileLine(p, l->tokens, l->length);
+		if(!l->code) {
+			l->count = -1;
+			return false;
+		}
+	}
+	return runCode(p, l->code, p->integers, &p->do_else);
+}
+
+/* PARALLEL FOR var = a TO b [SUM s] [MIN s] [MAX s] ... NEXT runs the
+ * index range in chunks on a pool of threads. the body has to compile,
+ * so it only does integer assignments. each chunk starts from the
+ * scalars as they were before the loop and works on its own copy, so
+ * chunks don't see each other's scalars. afterwards scalars hold what
+ * the chunk with the last index left, except that SUM, MIN and MAX
+ * variables are combined over every chunk. iterations share arrays and
+ * must not read elements that other iterations write */
+
+typedef struct reduction {
+	int var, kw;
+	int val;
+} Reduction;
+
+typedef struct parallel {
+	Program *p;
+	Code **body;
+	int *lines; /* where each body op came from, for errors */
+	int num_body;
+	int var, from, step;
+	long count, chunk, next;
+	Reduction *reductions;
+	int num_reductions;
+	Variable *last; /* the scalars after the last chunk */
+	long failed; /* first index that could not run, or -1 */
+	int failed_line;
+	long steps;
+	pthread_mutex_t lock;
+} Parallel;
+
+/* where SUM, MIN and MAX clauses start, or n */
+int reductionStart(Token *tokens, int n) {
+	for(int i = 0; i+1 < n; i++)
+		if(tokens[i+1].type == SYMBOL && (isKeyword(tokens[i], KW_SUM)
+				|| isKeyword(tokens[i], KW_MIN)
+				|| isKeyword(tokens[i], KW_MAX)))
+			return i;
+	return n;
+}
+
+/* the NEXT closing the loop that starts on line (numbered from 0) */
+int findNext(Program *p, int line) {
+	int depth = 0;
+	for(int i = line+1; i < p->num_lines; i++) {
+		Line *l = getLine(p, i);
+		if(!l->length)
+			continue;
+		if(isKeyword(l->tokens[0], KW_FOR)
+				|| isKeyword(l->tokens[0], KW_PARALLEL))
+			depth++;
+		else if(isKeyword(l->tokens[0], KW_NEXT) && !depth--)
+			return i;
+	}
+	runError(p, "EXPECT NEXT AFTER PARALLEL FOR\n");
+	return 0;
+}
+
+int reduce(int kw, int a, int b) {
+	if(kw == KW_SUM)
+		return (unsigned)a + b;
+	if(kw == KW_MIN)
+		return (a < b) ? a : b;
+	return (a > b) ? a : b;
+}
+
+/* budgets are only looked at between chunks */
+bool overBudget(Program *p, long steps) {
+	return (p->max_steps && p->steps+steps > p->max_steps)
+		|| (p->deadline && milliseconds() > p->deadline);
+}
+
+/* a worker takes chunks until the range runs out. chunks are handed
+ * out in order, so the first index that fails is found even when other
+ * chunks are still running */
+void *runChunks(void *arg) {
+	Parallel *w = arg;
+	Program *p = w->p;
+	Variable *vars = malloc(sizeof(Variable)*p->num_integers);
+	bool do_else;
+	long steps = 0;
+
+	for(;;) {
+		pthread_mutex_lock(&w->lock);
+		long start = w->next;
+		w->next += w->chunk;
+		bool stop = w->failed >= 0 || overBudget(p, start*w->num_body);
+		pthread_mutex_unlock(&w->lock);
+		if(stop || start >= w->count)
+			break;
+		long end = (start+w->chunk < w->count) ? start+w->chunk : w->count;
+
+		memcpy(vars, p->integers, sizeof(Variable)*p->num_integers);
+		for(int i = 0; i < w->num_reductions; i++)
+			if(w->reductions[i].kw == KW_SUM)
+				vars[w->reductions[i].var].val.i = 0;
+
+		long k = start;
+		int j = 0;
+		for(; k < end; k++) {
+			vars[w->var].val.i = (unsigned)w->from+(unsigned)(k*w->step);
+			for(j = 0; j < w->num_body; j++)
+				if(!runCode(p, w->body[j], vars, &do_else))
+					break;
+			if(j < w->num_body)
+				break;
+		}
+		steps += (k-start)*w->num_body + ((k < end) ? j : 0);
+
+		pthread_mutex_lock(&w->lock);
+		if(k < end && (w->failed < 0 || k < w->failed)) {
+			w->failed = k;
+			w->failed_line = w->lines[j];
+		}
+		for(int i = 0; i < w->num_reductions; i++) {
+			Reduction *r = &w->reductions[i];
+			r->val = reduce(r->kw, r->val, vars[r->var].val.i);
+		}
+		if(end == w->count)
+			memcpy(w->last, vars, sizeof(Variable)*p->num_integers);
+		pthread_mutex_unlock(&w->lock);
+	}
+
+	pthread_mutex_lock(&w->lock);
+	w->steps += steps;
+	pthread_mutex_unlock(&w->lock);
+	free(vars);
+	return 0;
+}
+
+void runParallel(Program *p, Token *tokens, int n) {
+	syntaxAssert(p, n >= 7 && isKeyword(tokens[1], KW_FOR));
+	if(p->num_frames) {
+		runError(p, "PARALLEL FOR CANNOT RUN IN A FUNCTION\n");
+	}
+	int line = p->line-1;
+	int next = findNext(p, line);
+	int end = reductionStart(tokens, n);
+	int found = 0;
+	for(int i = 2; i < end && !found; i++)
+		if(isKeyword(tokens[i], KW_TO))
+			found = i;
+	syntaxAssert(p, found && tokens[2].type == SYMBOL);
+	syntaxAssert(p, !isStringName(tokens[2].val.s));
+	syntaxAssert(p, isKeyword(tokens[3], KW_EQ));
+	int i1 = expectInteger(p, evalExpression(p, tokens+4, found-4));
+	int i2 = expectInteger(p, evalExpression(p, tokens+found+1,
+			end-found-1));
+
+	Parallel w = (Parallel){.p = p, .from = i1,
+		.step = (i1 <= i2) ? 1 : -1};
+	w.count = labs((long)i2-i1)+1;
+	w.failed = -1;
+
+	/* compiling first makes every variable the body uses exist */
+	w.body = malloc(sizeof(Code*)*(next-line));
+	w.lines = malloc(sizeof(int)*(next-line));
+	for(int i = line+1; i < next; i++) {
+		Line *l = getLine(p, i);
+		if(!l->length || isKeyword(l->tokens[0], KW_REM)
+				|| l->tokens[0].type == LABEL)
+			continue;
+		if(!l->code)
+			l->code = compileLine(p, l->tokens, l->length);
+		if(!l->code) {
+			free(w.body);
+			free(w.lines);
+			p->line = i+1;
+			runError(p, "PARALLEL FOR CAN ONLY ASSIGN INTEGERS\n");
+		}
+		w.lines[w.num_body] = i;
+		w.body[w.num_body++] = l->code;
+	}
+	w.var = integerIndex(p, tokens[2].val.s);
+	for(int i = end; i+1 < n; i += 2) {
+		w.reductions = realloc(w.reductions,
+				sizeof(Reduction)*(w.num_reductions+1));
+		int v = integerIndex(p, tokens[i+1].val.s);
+		w.reductions[w.num_reductions++] = (Reduction){v,
+			tokens[i].val.i, p->integers[v].val.i};
+	}
+	w.last = malloc(sizeof(Variable)*p->num_integers);
+
+	int threads = (p->threads) ? p->threads : sysconf(_SC_NPROCESSORS_ONLN);
+	if(threads < 1)
+		threads = 1;
+	w.chunk = w.count/(threads*8);
+	if(w.chunk < 1)
+		w.chunk = 1;
+	if(w.chunk > MAX_CHUNK)
+		w.chunk = MAX_CHUNK;
+	if(threads > (w.count+w.chunk-1)/w.chunk)
+		threads = (w.count+w.chunk-1)/w.chunk;
+
+	pthread_mutex_init(&w.lock, 0);
+	pthread_t *pool = malloc(sizeof(pthread_t)*threads);
+	int started = 1;
+	for(; started < threads; started++)
+		if(pthread_create(&pool[started], 0, runChunks, &w) != 0)
+			break;
+	runChunks(&w);
+	for(int i = 1; i < started; i++)
+		pthread_join(pool[i], 0);
+	pthread_mutex_destroy(&w.lock);
+	free(pool);
+
+	/* runLines stops the run if a budget ran out */
+	p->steps += w.steps;
+	p->countdown = 0;
+	if(w.failed < 0 && !overBudget(p, 0)) {
+		memcpy(p->integers, w.last, sizeof(Variable)*p->num_integers);
+		for(int i = 0; i < w.num_reductions; i++)
+			p->integers[w.reductions[i].var].val.i = w.reductions[i].val;
+		/* where a plain FOR would leave it */
+		p->integers[w.var].val.i = (i1 == i2) ? i1
+			: (int)((unsigned)i2+w.step);
+	}
+	else
+		p->integers[w.var].val.i = (unsigned)w.from+w.failed*w.step;
+	free(w.body);
+	free(w.lines);
+	free(w.reductions);
+	free(w.last);
+
+	if(w.failed >= 0) {
+		p->line = w.failed_line+1;
+		runError(p, "PARALLEL FOR FAILED WITH %s = %d\n", tokens[2].val.s,
+				p->integers[w.var].val.i);
+	}
+	p->line = next+1;
 }
 
 void pushForLoop(Program *p, ForLoop l) {
 	p->forLoops[p->num_forLoops++] = l;
 	if(p->num_forLoops > p->max_forLoops-10) {
+		useMemory(p, 20*sizeof(ForLoop));
 		p->max_forLoops += 20;
 		p->forLoops = realloc(p->forLoops,
 				p->max_forLoops*sizeof(ForLoop));
 	}
 }
 
-ForLoop popForLoop(Program *p) {
-	syntaxAssert(p, p->num_forLoops != 0);
-	return p->forLoops[--(p->num_forLoops)];
+ForLoop popForLoop(Program *p) {
+	syntaxAssert(p, p->num_forLoops != 0);
+	return p->forLoops[--(p->num_forLoops)];
+}
+
+void pushReturnLine(Program *p, int line) {
+	p->returnLines[p->num_returnLines++] = line;
+	if(p->num_returnLines > p->max_returnLines-10) {
+		useMemory(p, 20*sizeof(int));
+		p->max_returnLines += 20;
+		p->returnLines = realloc(p->returnLines,
+				p->max_returnLines*sizeof(int));
+	}
+}
+
+int popReturnLine(Program *p) {
+	syntaxAssert(p, p->num_returnLines != 0);
+	return p->returnLines[--(p->num_returnLines)];
+}
+
+/* SNAPSHOT "file" saves the variables, arrays and FOR/GOSUB stacks as
+ * an image, and --restore loads one and carries on from the line after
+ * the SNAPSHOT instead of running the setup code again. an image only
+ * fits the program it was taken from */
+
+typedef struct image {
+	char *data;
+	int len, max;
+	int at;
+} Image;
+
+enum {
+	IMAGE_VERSION = 4,
+};
+
+void putBytes(Image *m, const void *b, int len) {
+	if(m->len+len > m->max) {
+		m->max = (m->len+len)*2;
+		m->data = realloc(m->data, m->max);
+	}
+	memcpy(m->data+m->len, b, len);
+	m->len += len;
+}
+
+void putInt(Image *m, int d) {
+	putBytes(m, &d, sizeof(int));
+}
+
+void putText(Image *m, const char *s) {
+	int len = (s) ? (int)strlen(s) : -1;
+	putInt(m, len);
+	if(s)
+		putBytes(m, s, len);
+}
+
+const void *takeBytes(Program *p, Image *m, int len) {
+	if(len < 0 || m->at+len > m->len) {
+		runError(p, "STATE IMAGE IS DAMAGED\n");
+	}
+	m->at += len;
+	return m->data+m->at-len;
+}
+
+int takeInt(Program *p, Image *m) {
+	int d;
+	memcpy(&d, takeBytes(p, m, sizeof(int)), sizeof(int));
+	return d;
+}
+
+/* a count of entries that follow, each taking at least a byte */
+int takeCount(Program *p, Image *m) {
+	int n = takeInt(p, m);
+	if(n < 0 || n > m->len-m->at) {
+		runError(p, "STATE IMAGE IS DAMAGED\n");
+	}
+	return n;
+}
+
+/* a new string, or 0 if none was saved */
+char *takeText(Program *p, Image *m) {
+	int len = takeInt(p, m);
+	if(len < 0)
+		return 0;
+	const void *b = takeBytes(p, m, len);
+	char *s = malloc(len+1);
+	memcpy(s, b, len);
+	s[len] = 0;
+	return s;
+}
+
+/* a name the lexer could have read: no spaces, quotes or operators.
+ * type is STRING or INTEGER for the names of those, or SYMBOL for
+ * either */
+char *takeIdentifier(Program *p, Image *m, int type) {
+	int len = takeInt(p, m);
+	const char *b = takeBytes(p, m, len);
+	for(int i = 0; i < len; i++)
+		if(!b[i] || charClass[(unsigned char)b[i]] != C_OTHER)
+			len = 0;
+	if(!len || (type != SYMBOL && (b[len-1] == '$') != (type == STRING))) {
+		runError(p, "STATE IMAGE IS DAMAGED\n");
+	}
+	char *s = malloc(len+1);
+	memcpy(s, b, len);
+	s[len] = 0;
+	return s;
+}
+
+unsigned hashProgram(Program *p) {
+	unsigned h = 2166136261u;
+	for(int i = 0; i < p->num_lines; i++)
+		for(const char *c = p->lines[i].text;; c++) {
+			h = (h ^ (unsigned char)*c)*16777619u;
+			if(!*c)
+				break;
+		}
+	return h;
+}
+
+void saveState(Program *p, Image *m) {
+	syntaxAssert(p, p->num_frames == 0);
+	putBytes(m, "BAS", 4);
+	putInt(m, IMAGE_VERSION);
+	putInt(m, hashProgram(p));
+	putInt(m, p->line);
+	putInt(m, p->do_else);
+	putInt(m, p->trap);
+	putBytes(m, &p->seed, sizeof(p->seed));
+
+	putInt(m, p->num_integers);
+	for(int i = 0; i < p->num_integers; i++) {
+		putText(m, p->integers[i].identifier);
+		putInt(m, p->integers[i].val.i);
+	}
+	putInt(m, p->num_strings);
+	for(int i = 0; i < p->num_strings; i++) {
+		putText(m, p->strings[i].identifier);
+		putText(m, p->strings[i].val.s);
+	}
+
+	putInt(m, p->num_integerArrays);
+	for(int i = 0; i < p->num_integerArrays; i++) {
+		IntegerArray *a = &p->integerArrays[i];
+		putText(m, a->identifier);
+		putInt(m, a->num_integers);
+		putBytes(m, a->integers, sizeof(int)*a->num_integers);
+	}
+	putInt(m, p->num_stringArrays);
+	for(int i = 0; i < p->num_stringArrays; i++) {
+		StringArray *a = &p->stringArrays[i];
+		putText(m, a->identifier);
+		putInt(m, a->num_strings);
+		for(int j = 0; j < a->num_strings; j++)
+			putText(m, elementText(a, j));
+	}
+	putInt(m, p->num_maps);
+	for(int i = 0; i < p->num_maps; i++) {
+		Map *a = &p->maps[i];
+		putText(m, a->identifier);
+		putInt(m, a->num_entries);
+		for(int j = 0; j < a->num_entries; j++) {
+			Value *v = &a->entries[j].key;
+			for(int k = 0; k < 2; k++, v = &a->entries[j].val) {
+				putInt(m, (isInteger(*v)) ? INTEGER : STRING);
+				if(isInteger(*v))
+					putInt(m, valueInteger(*v));
+				else
+					putText(m, valueString(*v));
+			}
+		}
+	}
+
+	putInt(m, p->num_forLoops);
+	for(int i = 0; i < p->num_forLoops; i++) {
+		ForLoop *f = &p->forLoops[i];
+		putInt(m, f->i1);
+		putInt(m, f->i2);
+		putInt(m, f->line);
+		putText(m, f->s);
+	}
+	putInt(m, p->num_returnLines);
+	putBytes(m, p->returnLines, sizeof(int)*p->num_returnLines);
+}
+
+/* FOR loops point at the variable name in their FOR line's tokens */
+char *forVariable(Program *p, int line, const char *identifier) {
+	if(line >= 1 && line <= p->num_lines) {
+		Line *l = getLine(p, line-1);
+		for(int i = 0; i < l->length; i++)
+			if(l->tokens[i].type == SYMBOL
+					&& strcmp(l->tokens[i].val.s, identifier) == 0)
+				return l->tokens[i].val.s;
+	}
+	runError(p, "STATE DOES NOT MATCH PROGRAM\n");
+	return 0;
+}
+
+void loadState(Program *p, Image *m) {
+	if(memcmp(takeBytes(p, m, 4), "BAS", 4) != 0
+			|| takeInt(p, m) != IMAGE_VERSION
+			|| (unsigned)takeInt(p, m) != hashProgram(p)) {
+		runError(p, "STATE DOES NOT MATCH PROGRAM\n");
+	}
+	clearVariables(p);
+	resetProgram(p);
+	p->line = takeInt(p, m);
+	p->do_else = takeInt(p, m);
+	p->trap = takeInt(p, m);
+	memcpy(&p->seed, takeBytes(p, m, sizeof(p->seed)), sizeof(p->seed));
+	if(p->line < 0 || p->line > p->num_lines
+			|| p->trap < 0 || p->trap > p->num_lines) {
+		runError(p, "STATE DOES NOT MATCH PROGRAM\n");
+	}
+
+	/* entries are added as soon as their name is read and filled in
+	 * after, and other text is held as temps, so a damaged image still
+	 * leaves everything where it can be freed */
+	int n = takeCount(p, m);
+	useMemory(p, (long)n*sizeof(Variable));
+	p->integers = malloc(sizeof(Variable)*n);
+	p->max_integers = n;
+	for(int i = 0; i < n; i++) {
+		Variable *v = &p->integers[p->num_integers];
+		v->identifier = takeIdentifier(p, m, INTEGER);
+		p->num_integers++;
+		v->val.i = takeInt(p, m);
+	}
+	n = takeCount(p, m);
+	useMemory(p, (long)n*sizeof(Variable));
+	p->strings = malloc(sizeof(Variable)*n);
+	p->max_strings = n;
+	for(int i = 0; i < n; i++) {
+		Variable *v = &p->strings[p->num_strings];
+		v->identifier = takeIdentifier(p, m, STRING);
+		v->val.s = 0;
+		p->num_strings++;
+		char *s = takeText(p, m);
+		addTemp(p, s);
+		v->val.s = copyString(p, (s) ? s : "");
+		releaseTemps(p);
+	}
+
+	n = takeCount(p, m);
+	useMemory(p, (long)n*sizeof(IntegerArray));
+	p->integerArrays = malloc(sizeof(IntegerArray)*n);
+	p->max_integerArrays = n;
+	for(int i = 0; i < n; i++) {
+		IntegerArray *a = &p->integerArrays[p->num_integerArrays];
+		a->identifier = takeIdentifier(p, m, INTEGER);
+		a->integers = 0;
+		a->num_integers = 0;
+		p->num_integerArrays++;
+		int sz = takeCount(p, m);
+		const void *b = takeBytes(p, m, sizeof(int)*sz);
+		useMemory(p, (long)sz*sizeof(int));
+		a->integers = malloc(sizeof(int)*sz);
+		a->num_integers = sz;
+		memcpy(a->integers, b, sizeof(int)*sz);
+	}
+	n = takeCount(p, m);
+	p->stringArrays = malloc(sizeof(StringArray)*n);
+	for(int i = 0; i < n; i++) {
+		StringArray *a = &p->stringArrays[p->num_stringArrays];
+		a->identifier = takeIdentifier(p, m, STRING);
+		initStringArray(a, 0);
+		p->num_stringArrays++;
+		int sz = takeCount(p, m);
+		useMemory(p, (long)sz*sizeof(StringElement));
+		free(a->strings);
+		initStringArray(a, sz);
+		for(int j = 0; j < a->num_strings; j++) {
+			char *s = takeText(p, m);
+			addTemp(p, s);
+			if(s)
+				setStringElement(p, a, j, s);
+			releaseTemps(p);
+		}
+	}
+	n = takeCount(p, m);
+	for(int i = 0; i < n; i++) {
+		char *identifier = takeIdentifier(p, m, SYMBOL);
+		dimMap(p, identifier);
+		Map *a = getMap(p, identifier);
+		free(identifier);
+
+		int entries = takeCount(p, m);
+		for(int j = 0; j < entries; j++) {
+			Value v[2];
+			for(int k = 0; k < 2; k++) {
+				if(takeInt(p, m) == STRING) {
+					char *s = takeText(p, m);
+					syntaxAssert(p, s != 0);
+					addTemp(p, s);
+					v[k] = stringValue(s);
+				}
+				else
+					v[k] = integerValue(takeInt(p, m));
+			}
+			setMapVal(p, a, v[0], v[1]);
+			releaseTemps(p);
+		}
+	}
+
+	n = takeCount(p, m);
+	for(int i = 0; i < n; i++) {
+		ForLoop f;
+		f.i1 = takeInt(p, m);
+		f.i2 = takeInt(p, m);
+		f.line = takeInt(p, m);
+		char *s = takeIdentifier(p, m, INTEGER);
+		addTemp(p, s);
+		f.s = forVariable(p, f.line, s);
+		releaseTemps(p);
+		pushForLoop(p, f);
+	}
+	n = takeCount(p, m);
+	for(int i = 0; i < n; i++) {
+		int line = takeInt(p, m);
+		if(line < 0 || line > p->num_lines) {
+			runError(p, "STATE DOES NOT MATCH PROGRAM\n");
+		}
+		pushReturnLine(p, line);
+	}
+}
+
+/* untrusted programs may not touch the file system */
+void checkSandbox(Program *p) {
+	if(p->sandbox) {
+		runError(p, "FILES ARE DISABLED\n");
+	}
+}
+
+void writeState(Program *p, const char *filename) {
+	checkSandbox(p);
+	Image m = (Image){0, 0, 0, 0};
+	saveState(p, &m);
+	FILE *fp = fopen(filename, "wb");
+	if(!fp || fwrite(m.data, 1, m.len, fp) != (size_t)m.len) {
+		if(fp)
+			fclose(fp);
+		free(m.data);
+		runError(p, "FAILED TO WRITE %s\n", filename);
+	}
+	fclose(fp);
+	free(m.data);
+}
+
+void readState(Program *p, const char *filename) {
+	FILE *fp = fopen(filename, "rb");
+	if(!fp) {
+		printf("failed to open %s\n", filename);
+		freeProgram(p);
+		exit(1);
+	}
+	fseek(fp, 0, SEEK_END);
+	Image m = (Image){0, ftell(fp), 0, 0};
+	fseek(fp, 0, SEEK_SET);
+	m.data = malloc(m.len+1);
+	m.len = fread(m.data, 1, m.len, fp);
+	fclose(fp);
+
+	loadState(p, &m);
+	free(m.data);
+}
+
+enum {
+	TRACE_VERSION = 1,
+};
+
+void openTrace(Program *p, const char *filename, bool replay) {
+	p->trace = fopen(filename, (replay) ? "rb" : "wb");
+	if(!p->trace) {
+		fprintf(p->errors, "failed to open %s\n", filename);
+		freeProgram(p);
+		exit(1);
+	}
+	p->replay = replay;
+	if(!replay) {
+		fwrite("BTR", 1, 4, p->trace);
+		putVarint(p->trace, TRACE_VERSION);
+		putVarint(p->trace, hashProgram(p));
+		return;
+	}
+
+	char magic[4];
+	if(fread(magic, 1, 4, p->trace) != 4 || memcmp(magic, "BTR", 4) != 0
+			|| takeVarint(p->trace) != TRACE_VERSION
+			|| takeVarint(p->trace) != hashProgram(p)) {
+		fprintf(p->errors, "TRACE DOES NOT MATCH PROGRAM\n");
+		freeProgram(p);
+		exit(1);
+	}
+}
+
+/* prints a trace for reading, without the program. jumps give the line
+ * the run went on at, numbered from 1 */
+void showTrace(const char *filename) {
+	FILE *fp = fopen(filename, "rb");
+	char magic[4];
+	if(!fp || fread(magic, 1, 4, fp) != 4 || memcmp(magic, "BTR", 4) != 0
+			|| takeVarint(fp) != TRACE_VERSION) {
+		printf("%s is not a trace\n", filename);
+		if(fp)
+			fclose(fp);
+		return;
+	}
+	printf("program %08x\n", takeVarint(fp));
+	for(int c = fgetc(fp); c != EOF; c = fgetc(fp)) {
+		if(c == 'J')
+			printf("JUMP %u\n", takeVarint(fp)+1);
+		else if(c == 'T' || c == 'F')
+			printf("IF %s\n", (c == 'T') ? "TRUE" : "FALSE");
+		else if(c == 'I') {
+			printf("INPUT \"");
+			for(unsigned len = takeVarint(fp); len; len--) {
+				int d = fgetc(fp);
+				if(d == EOF)
+					break;
+				putchar(d);
+			}
+			printf("\"\n");
+		}
+		else {
+			printf("DAMAGED AT BYTE %ld\n", ftell(fp)-1);
+			break;
+		}
+	}
+	fclose(fp);
+}
+
+/* parses #n in a file statement and returns the open file */
+FILE *fileArgument(Program *p, Token *tokens, int n, int *i) {
+	syntaxAssert(p, *i < n && isKeyword(tokens[(*i)++], KW_HASH));
+	return getFile(p, expectInteger(p, evalOr(p, tokens, n, i, false)));
+}
+
+/* OPEN name FOR INPUT|OUTPUT|APPEND AS #n */
+void openFile(Program *p, Token *tokens, int n) {
+	checkSandbox(p);
+	int found = 0;
+	for(int i = 0; i < n && !found; i++)
+		if(isKeyword(tokens[i], KW_FOR))
+			found = i;
+	syntaxAssert(p, found && found+4 < n);
+	syntaxAssert(p, isKeyword(tokens[found+2], KW_AS));
+	syntaxAssert(p, isKeyword(tokens[found+3], KW_HASH));
+
+	char *name = expectString(p, evalExpression(p, tokens+1, found-1));
+	int f = expectInteger(p, evalExpression(p, tokens+found+4,
+			n-found-4));
+	if(f < 1 || f > MAX_FILES) {
+		runError(p, "INVALID FILE NUMBER %d\n", f);
+	}
+
+	const char *mode = 0;
+	if(isKeyword(tokens[found+1], KW_INPUT))
+		mode = "rb";
+	else if(isKeyword(tokens[found+1], KW_OUTPUT))
+		mode = "wb";
+	else if(isKeyword(tokens[found+1], KW_APPEND))
+		mode = "ab";
+	syntaxAssert(p, mode != 0);
+
+	FILE **fp = &p->files[f-1];
+	if(*fp)
+		fclose(*fp);
+	*fp = fopen(name, mode);
+	if(!*fp) {
+		runError(p, "FAILED TO OPEN %s\n", name);
+	}
+}
+
+/* READ #n, a() fills an integer array with one fread of raw ints, and
+ * WRITE #n, a() dumps it with one fwrite. an array that doesn't exist
+ * yet is sized to the rest of the stream, read into a growing buffer
+ * since a pipe can't seek to its end */
+void transferArray(Program *p, Token *tokens, int n) {
+	int i = 1;
+	FILE *fp = fileArgument(p, tokens, n, &i);
+	syntaxAssert(p, i+4 == n && tokens[i].type == COMMA);
+	syntaxAssert(p, tokens[i+1].type == SYMBOL);
+	syntaxAssert(p, isKeyword(tokens[i+2], KW_LPAREN));
+	syntaxAssert(p, isKeyword(tokens[i+3], KW_RPAREN));
+	char *identifier = tokens[i+1].val.s;
+	syntaxAssert(p, !isStringName(identifier));
+
+	int a = integerArrayIndex(p, identifier);
+	if(a < 0) {
+		if(!isKeyword(tokens[0], KW_READ)) {
+			runError(p, "COULD NOT FIND %s\n", identifier);
+		}
+		int *buf = 0;
+		size_t sz = 0, max = 0, got;
+		do {
+			if(sz == max) {
+				max = (max) ? max*2 : 256;
+				buf = realloc(buf, max*sizeof(int));
+			}
+			got = fread(buf+sz, sizeof(int), max-sz, fp);
+			sz += got;
+		} while(got > 0);
+		addTemp(p, (char*)buf);
+		if(ferror(fp)) {
+			runError(p, "FAILED TO READ %s\n", identifier);
+		}
+		if(sz == 0 || sz > INT_MAX) {
+			runError(p, "NOTHING TO READ INTO %s\n", identifier);
+		}
+		dimIntegerArray(p, identifier, sz);
+		IntegerArray *arr = &p->integerArrays[p->num_integerArrays-1];
+		memcpy(arr->integers, buf, sz*sizeof(int));
+		return;
+	}
+
+	IntegerArray *arr = &p->integerArrays[a];
+	size_t done;
+	if(isKeyword(tokens[0], KW_READ))
+		done = fread(arr->integers, sizeof(int), arr->num_integers, fp);
+	else
+		done = fwrite(arr->integers, sizeof(int), arr->num_integers, fp);
+	if(done != (size_t)arr->num_integers) {
+		runError(p, "ONLY %zu OF %d INTEGERS IN %s WERE %s\n", done,
+				arr->num_integers, identifier,
+				(isKeyword(tokens[0], KW_READ)) ? "READ" : "WRITTEN");
+	}
+}
+
+/* index of the bracket closing the one opened at tokens[open] */
+int matchClose(Token *tokens, int n, int open) {
+	int depth = 0;
+	for(int i = open; i < n; i++) {
+		if(isKeyword(tokens[i], KW_LPAREN))
+			depth++;
+		else if(isKeyword(tokens[i], KW_RPAREN) && --depth == 0)
+			return i;
+	}
+	return 0;
+}
+
+/* an operand in a() = ..., either a whole array, a result held in the
+ * statement's temporaries, or one value for every element */
+typedef struct vector {
+	int array; /* index into integerArrays, or -1 */
+	int *v;
+	int k;
+} Vector;
+
+int *newVector(Program *p, int len) {
+	int *v = malloc(sizeof(int)*len);
+	/* freed with the statement, even if it fails */
+	addTemp(p, (char*)v);
+	return v;
+}
+
+/* the len elements of x. arrays are looked up only now, as a function
+ * called for a later operand may have redimensioned them */
+int *vectorData(Program *p, Vector x, int len) {
+	if(x.v)
+		return x.v;
+	if(x.array < 0) {
+		int *v = newVector(p, len);
+		for(int i = 0; i < len; i++)
+			v[i] = x.k;
+		return v;
+	}
+	IntegerArray *a = &p->integerArrays[x.array];
+	if(a->num_integers != len) {
+		runError(p, "ARRAY SIZES DIFFER\n");
+	}
+	return a->integers;
+}
+
+/* one operator over whole arrays. r is never a or b, and the loops are
+ * kept plain so the compiler vectorizes them */
+void vectorOp(Program *p, int op, int *restrict r, const int *restrict a,
+		const int *restrict b, int len)
+{
+	switch(op) {
+	case KW_PLUS:
+		for(int i = 0; i < len; i++)
+			r[i] = (unsigned)a[i] + b[i];
+		return;
+	case KW_MINUS:
+		for(int i = 0; i < len; i++)
+			r[i] = (unsigned)a[i] - b[i];
+		return;
+	case KW_TIMES:
+		for(int i = 0; i < len; i++)
+			r[i] = (unsigned)a[i] * b[i];
+		return;
+	}
+
+	for(int i = 0; i < len; i++)
+		if(b[i] == 0) {
+			runError(p, "DIVISION BY ZERO\n");
+		}
+	if(op == KW_MOD)
+		for(int i = 0; i < len; i++)
+			r[i] = modulo(a[i], b[i]);
+	else
+		for(int i = 0; i < len; i++)
+			r[i] = (b[i] == -1) ? (int)-(unsigned)a[i] : a[i] / b[i];
+}
+
+Vector evalVector(Program *p, Token *tokens, int n, int *i, int len,
+		int level);
+
+Vector evalVectorPrimary(Program *p, Token *tokens, int n, int *i, int len) {
+	syntaxAssert(p, *i < n);
+	if(isKeyword(tokens[*i], KW_LPAREN)) {
+		(*i)++;
+		Vector x = evalVector(p, tokens, n, i, len, 1);
+		syntaxAssert(p, *i < n && isKeyword(tokens[(*i)++], KW_RPAREN));
+		return x;
+	}
+
+	if(*i+2 < n && tokens[*i].type == SYMBOL
+			&& isKeyword(tokens[*i+1], KW_LPAREN)
+			&& isKeyword(tokens[*i+2], KW_RPAREN)) {
+		char *identifier = tokens[*i].val.s;
+		syntaxAssert(p, !isStringName(identifier));
+		int a = integerArrayIndex(p, identifier);
+		if(a < 0) {
+			runError(p, "COULD NOT FIND %s\n", identifier);
+		}
+		*i += 3;
+		return (Vector){a, 0, 0};
+	}
+
+	/* anything else is the same for every element */
+	Value v = evalPrimary(p, tokens, n, i, false);
+	return (Vector){-1, 0, expectInteger(p, v)};
+}
+
+Vector evalVectorUnary(Program *p, Token *tokens, int n, int *i, int len) {
+	if(*i >= n || !isKeyword(tokens[*i], KW_MINUS))
+		return evalVectorPrimary(p, tokens, n, i, len);
+	(*i)++;
+	Vector x = evalVectorUnary(p, tokens, n, i, len);
+	if(x.array < 0 && !x.v)
+		return (Vector){-1, 0, -(unsigned)x.k};
+	int *a = vectorData(p, x, len);
+	int *r = newVector(p, len);
+	for(int j = 0; j < len; j++)
+		r[j] = -(unsigned)a[j];
+	return (Vector){-1, r, 0};
+}
+
+/* levels are 1 for + - and 2 for * / MOD. two plain values are worked
+ * out as usual, otherwise both sides are spread over len elements */
+Vector evalVector(Program *p, Token *tokens, int n, int *i, int len,
+		int level)
+{
+	Vector x = (level == 2) ? evalVectorUnary(p, tokens, n, i, len)
+		: evalVector(p, tokens, n, i, len, 2);
+
+	while(*i < n && operatorLevel(tokens[*i]) == level) {
+		int op = tokens[(*i)++].val.i;
+		Vector y = (level == 2) ? evalVectorUnary(p, tokens, n, i, len)
+			: evalVector(p, tokens, n, i, len, 2);
+
+		if(x.array < 0 && !x.v && y.array < 0 && !y.v) {
+			x.k = valueInteger(doOp(p, integerValue(x.k),
+					integerValue(y.k), op));
+			continue;
+		}
+		int *a = vectorData(p, x, len);
+		int *b = vectorData(p, y, len);
+		int *r = newVector(p, len);
+		vectorOp(p, op, r, a, b, len);
+		x = (Vector){-1, r, 0};
+	}
+	return x;
+}
+
+/* a() = expression sets every element at once, with b() standing for
+ * all of b's elements. a() = 0 clears a */
+void runArrayAssignment(Program *p, Token *tokens, int n) {
+	char *identifier = tokens[0].val.s;
+	syntaxAssert(p, n > 4 && !isStringName(identifier));
+	int t = integerArrayIndex(p, identifier);
+	if(t < 0) {
+		runError(p, "COULD NOT FIND %s\n", identifier);
+	}
+	int len = p->integerArrays[t].num_integers;
+
+	int i = 4;
+	Vector x = evalVector(p, tokens, n, &i, len, 1);
+	syntaxAssert(p, i == n);
+
+	int *a = vectorData(p, (Vector){t, 0, 0}, len);
+	if(x.array < 0 && !x.v)
+		for(int j = 0; j < len; j++)
+			a[j] = x.k;
+	else
+		memmove(a, vectorData(p, x, len), sizeof(int)*len);
+}
+
+void runAssignment(Program *p, Token *tokens, int n) {
+	syntaxAssert(p, n >= 3);
+	syntaxAssert(p, tokens[1].type == KEYWORD);
+	bool is_str = isStringName(tokens[0].val.s);
+
+	/* array variable */
+	if(tokens[1].val.i == KW_LPAREN) {
+		int found = matchClose(tokens, n, 1);
+		if(!found) {
+			runError(p, "EXPECTED CLOSING BRACE\n");
+		}
+		syntaxAssert(p, found+1 < n && isKeyword(tokens[found+1], KW_EQ));
+		if(found == 2) {
+			runArrayAssignment(p, tokens, n);
+			return;
+		}
+
+		Value v1 = evalExpression(p, tokens+2, found-2);
+		Value v2 = evalExpression(p, tokens+found+2, n-found-2);
+
+		Map *m = getMap(p, tokens[0].val.s);
+		if(m) {
+			setMapVal(p, m, v1, v2);
+			return;
+		}
+		int d = expectInteger(p, v1);
+
+		if(is_str)
+			setStringArrayVal(p, tokens[0].val.s, d,
+					expectString(p, v2));
+		else
+			setIntegerArrayVal(p, tokens[0].val.s, d,
+					expectInteger(p, v2));
+		return;
+	}
+
+	/* non-array variable */
+	syntaxAssert(p, tokens[1].val.i == KW_EQ);
+
+	if(isKeyword(tokens[2], KW_INPUT)) {
+		/* the prompt was shown before suspending */
+		if(n > 3 && !p->input) {
+			writeValue(p->out, evalExpression(p, tokens+3, n-3));
+			fputc('\n', p->out);
+		}
+		if(!is_str) {
+			setIntegerVariable(p, tokens[0].val.s, getInteger(p));
+			return;
+		}
+		char *s = getInput(p);
+		setStringVariable(p, tokens[0].val.s, s);
+		free(s);
+		return;
+	}
+
+	Value v = evalExpression(p, tokens+2, n-2);
+	if(is_str)
+		setStringVariable(p, tokens[0].val.s, expectString(p, v));
+	else
+		setIntegerVariable(p, tokens[0].val.s, expectInteger(p, v));
+}
+
+/* the type an expression is sure to have, or -1 if that depends on
+ * the run. any operator gives an integer, so only a lone operand has to
+ * be looked at */
+int inferType(Program *p, Token *tokens, int n) {
+	if(n <= 0 || isKeyword(tokens[0], KW_INPUT))
+		return -1;
+
+	if(n == 1 && (tokens[0].type == INTEGER || tokens[0].type == STRING))
+		return tokens[0].type;
+	if(n == 1 && tokens[0].type == SYMBOL)
+		return isStringName(tokens[0].val.s) ? STRING : INTEGER;
+	if(isKeyword(tokens[0], KW_LPAREN) && matchClose(tokens, n, 0) == n-1)
+		return inferType(p, tokens+1, n-2);
+
+	if(n > 2 && isKeyword(tokens[1], KW_LPAREN)
+			&& matchClose(tokens, n, 1) == n-1) {
+		if(isKeyword(tokens[0], KW_EOF) || isKeyword(tokens[0], KW_COUNT)
+				|| isKeyword(tokens[0], KW_HAS)
+				|| (tokens[0].type == KEYWORD
+				&& mathArity(tokens[0].val.i)))
+			return INTEGER;
+		if(tokens[0].type != SYMBOL)
+			return -1;
+		/* DEF functions return whatever their expression gives */
+		Function *f = getFunction(p, tokens[0].val.s);
+		if(f && f->def)
+			return -1;
+		return isStringName(tokens[0].val.s) ? STRING : INTEGER;
+	}
+
+	for(int i = 0, depth = 0; i < n; i++) {
+		if(tokens[i].type != KEYWORD)
+			continue;
+		int kw = tokens[i].val.i;
+		if(kw == KW_LPAREN)
+			depth++;
+		else if(kw == KW_RPAREN)
+			depth--;
+		else if(!depth && (operatorLevel(tokens[i]) >= 0 || kw == KW_AND
+				|| kw == KW_OR || kw == KW_NOT))
+			return INTEGER;
+	}
+	return -1;
+}
+
+/* prints an error found before running, pointing at token at of line
+ * (numbered from 0) */
+void reportError(Program *p, const char *why, int line, int at) {
+	if(errorTrapped(p))
+		return;
+	Line *l = &p->lines[line];
+	int column = tokenColumn(l, at);
+	fprintf(p->errors, "%s AT LINE %d COLUMN %d\n", why,
+			lineNumber(p, line+1), column);
+	fprintf(p->errors, "  %s\n  ", l->text);
+	for(int i = 0; i < column-1; i++)
+		fputc((l->text[i] == '\t') ? '\t' : ' ', p->errors);
+	fprintf(p->errors, "^\n");
+}
+
+void typeMismatch(Program *p, Token *at, int *errors) {
+	Line *l = &p->lines[p->line-1];
+	reportError(p, "TYPE MISMATCH", p->line-1, at-l->tokens);
+	(*errors)++;
+}
+
+/* index of the GOTO or GOSUB in ON expr GOTO|GOSUB, 0 if none */
+int onJump(Token *tokens, int n) {
+	for(int i = 1; i < n; i++)
+		if(isKeyword(tokens[i], KW_GOTO) || isKeyword(tokens[i], KW_GOSUB))
+			return i;
+	return 0;
+}
+
+/* checks one statement the way runLine would split it up, and returns
+ * true for a lone integer assignment the compiler can take at once */
+bool checkStatement(Program *p, Token *tokens, int n, int *errors) {
+	if(n <= 0 || isKeyword(tokens[0], KW_REM))
+		return false;
+	if(isKeyword(tokens[0], KW_ELSE)) {
+		checkStatement(p, tokens+1, n-1, errors);
+		return false;
+	}
+	if(isKeyword(tokens[0], KW_IF)) {
+		int found = 0;
+		for(int i = 0; i < n && !found; i++)
+			if(isKeyword(tokens[i], KW_THEN))
+				found = i;
+		if(!found)
+			return false;
+		if(inferType(p, tokens+1, found-1) == STRING)
+			typeMismatch(p, tokens+1, errors);
+		checkStatement(p, tokens+found+1, n-found-1, errors);
+		return false;
+	}
+
+	for(int i = 0; i < n; i++)
+		if(tokens[i].type == COLON) {
+			checkStatement(p, tokens, i, errors);
+			checkStatement(p, tokens+i+1, n-i-1, errors);
+			return false;
+		}
+
+	if(isKeyword(tokens[0], KW_PARALLEL)) {
+		checkStatement(p, tokens+1, reductionStart(tokens, n)-1, errors);
+		return false;
+	}
+	if(isKeyword(tokens[0], KW_ON)) {
+		int found = onJump(tokens, n);
+		if(found && inferType(p, tokens+1, found-1) == STRING)
+			typeMismatch(p, tokens+1, errors);
+		return false;
+	}
+	if(isKeyword(tokens[0], KW_RANDOMIZE)) {
+		if(inferType(p, tokens+1, n-1) == STRING)
+			typeMismatch(p, tokens+1, errors);
+		return false;
+	}
+	if(isKeyword(tokens[0], KW_FOR)) {
+		for(int i = 3; i < n; i++)
+			if(isKeyword(tokens[i], KW_TO)) {
+				if(inferType(p, tokens+3, i-3) == STRING)
+					typeMismatch(p, tokens+3, errors);
+				if(inferType(p, tokens+i+1, n-i-1) == STRING)
+					typeMismatch(p, tokens+i+1, errors);
+				break;
+			}
+		return false;
+	}
+
+	if(tokens[0].type != SYMBOL || n < 3)
+		return false;
+	int eq = 1;
+	if(isKeyword(tokens[1], KW_LPAREN))
+		eq = matchClose(tokens, n, 1)+1;
+	if(eq >= n || !isKeyword(tokens[eq], KW_EQ))
+		return false;
+
+	int want = isStringName(tokens[0].val.s) ? STRING : INTEGER;
+	int type = inferType(p, tokens+eq+1, n-eq-1);
+	if(type >= 0 && type != want)
+		typeMismatch(p, tokens+eq+1, errors);
+	return type == INTEGER && (eq == 1
+			|| inferType(p, tokens+2, eq-3) == INTEGER);
+}
+
+/* the scan functions follow the eval ones without evaluating anything.
+ * they leave *i on the token they gave up at */
+
+bool scanOr(Program *p, Token *tokens, int n, int *i);
+
+bool scanToken(Token *tokens, int n, int *i, int type) {
+	if(*i >= n || tokens[*i].type != type)
+		return false;
+	(*i)++;
+	return true;
+}
+
+bool scanKeyword(Token *tokens, int n, int *i, int kw) {
+	if(*i >= n || !isKeyword(tokens[*i], kw))
+		return false;
+	(*i)++;
+	return true;
+}
+
+bool scanPrimary(Program *p, Token *tokens, int n, int *i) {
+	if(scanToken(tokens, n, i, INTEGER) || scanToken(tokens, n, i, STRING))
+		return true;
+	if(scanKeyword(tokens, n, i, KW_LPAREN))
+		return scanOr(p, tokens, n, i)
+			&& scanKeyword(tokens, n, i, KW_RPAREN);
+	if(scanKeyword(tokens, n, i, KW_EOF))
+		return scanKeyword(tokens, n, i, KW_LPAREN)
+			&& scanOr(p, tokens, n, i)
+			&& scanKeyword(tokens, n, i, KW_RPAREN);
+	if(scanKeyword(tokens, n, i, KW_COUNT))
+		return scanKeyword(tokens, n, i, KW_LPAREN)
+			&& scanToken(tokens, n, i, SYMBOL)
+			&& scanKeyword(tokens, n, i, KW_RPAREN);
+	if(scanKeyword(tokens, n, i, KW_HAS) || scanKeyword(tokens, n, i, KW_KEY))
+		return scanKeyword(tokens, n, i, KW_LPAREN)
+			&& scanToken(tokens, n, i, SYMBOL)
+			&& scanToken(tokens, n, i, COMMA)
+			&& scanOr(p, tokens, n, i)
+			&& scanKeyword(tokens, n, i, KW_RPAREN);
+
+	if(*i < n && tokens[*i].type == KEYWORD && mathArity(tokens[*i].val.i)) {
+		(*i)++;
+		if(!scanKeyword(tokens, n, i, KW_LPAREN))
+			return false;
+		do {
+			if(!scanOr(p, tokens, n, i))
+				return false;
+		} while(scanToken(tokens, n, i, COMMA));
+		return scanKeyword(tokens, n, i, KW_RPAREN);
+	}
+
+	if(*i >= n || tokens[*i].type != SYMBOL)
+		return false;
+	Function *f = getFunction(p, tokens[(*i)++].val.s);
+	if(!scanKeyword(tokens, n, i, KW_LPAREN))
+		return true;
+	/* arrays and maps take one index, functions a list. a() is the
+	 * whole array, for a() = ... */
+	if(!f)
+		return scanKeyword(tokens, n, i, KW_RPAREN)
+			|| (scanOr(p, tokens, n, i)
+			&& scanKeyword(tokens, n, i, KW_RPAREN));
+	while(*i < n && !isKeyword(tokens[*i], KW_RPAREN)) {
+		if(!scanOr(p, tokens, n, i))
+			return false;
+		if(!scanToken(tokens, n, i, COMMA))
+			break;
+	}
+	return scanKeyword(tokens, n, i, KW_RPAREN);
+}
+
+bool scanNot(Program *p, Token *tokens, int n, int *i) {
+	while(scanKeyword(tokens, n, i, KW_NOT))
+		;
+	for(;;) {
+		while(scanKeyword(tokens, n, i, KW_MINUS))
+			;
+		if(!scanPrimary(p, tokens, n, i))
+			return false;
+		if(*i >= n || operatorLevel(tokens[*i]) < 0)
+			return true;
+		(*i)++;
+	}
+}
+
+bool scanOr(Program *p, Token *tokens, int n, int *i) {
+	do {
+		if(!scanNot(p, tokens, n, i))
+			return false;
+	} while(scanKeyword(tokens, n, i, KW_AND)
+			|| scanKeyword(tokens, n, i, KW_OR));
+	return true;
+}
+
+/* -1 if tokens from..to are one expression, or where it went wrong */
+int scanRange(Program *p, Token *tokens, int from, int to) {
+	int i = from;
+	if(scanOr(p, tokens, to, &i) && i == to)
+		return -1;
+	return i;
+}
+
+/* #n in a file statement */
+bool scanFile(Program *p, Token *tokens, int n, int *i) {
+	return scanKeyword(tokens, n, i, KW_HASH) && scanOr(p, tokens, n, i);
+}
+
+int scanStatement(Program *p, Token *tokens, int n, const char **why);
+
+int scanRest(Program *p, Token *tokens, int n, int from, const char **why) {
+	int at = scanStatement(p, tokens+from, n-from, why);
+	return (at < 0) ? -1 : at+from;
+}
+
+/* a label that GOTO, GOSUB or ON ERROR GOTO can reach */
+int scanLabel(Program *p, Token *tokens, int n, int i, const char **why) {
+	if(i >= n)
+		return n;
+	if(tokens[i].type != SYMBOL)
+		return i;
+	if(i+1 < n)
+		return i+1;
+	if(!findLabel(p, tokens[i].val.s)) {
+		*why = "UNKNOWN LABEL";
+		return i;
+	}
+	return -1;
+}
+
+/* the labels or line numbers after GOTO or GOSUB, one of them unless
+ * list allows more separated by commas as after ON */
+int scanTargets(Program *p, Token *tokens, int n, int i, bool list,
+		const char **why)
+{
+	for(;;) {
+		if(i >= n)
+			return n;
+		if(tokens[i].type != SYMBOL && tokens[i].type != INTEGER)
+			return i;
+		if(targetLine(p, tokens[i]) < 0) {
+			*why = (tokens[i].type == INTEGER) ? "NO SUCH LINE"
+				: "UNKNOWN LABEL";
+			return i;
+		}
+		if(++i == n)
+			return -1;
+		if(!list || tokens[i].type != COMMA)
+			return i;
+		i++;
+	}
+}
+
+/* checks the shape of one statement the way runLine would take it.
+ * returns the index of the first token in the way (n when something is
+ * missing at the end), or -1 */
+int scanStatement(Program *p, Token *tokens, int n, const char **why) {
+	if(n <= 0 || isKeyword(tokens[0], KW_REM))
+		return -1;
+	if(isKeyword(tokens[0], KW_ELSE))
+		return scanRest(p, tokens, n, 1, why);
+	if(isKeyword(tokens[0], KW_IF)) {
+		int found = 0;
+		for(int i = 0; i < n && !found; i++)
+			if(isKeyword(tokens[i], KW_THEN))
+				found = i;
+		if(!found)
+			return n;
+		int at = scanRange(p, tokens, 1, found);
+		return (at < 0) ? scanRest(p, tokens, n, found+1, why) : at;
+	}
+
+	for(int i = 0; i < n; i++)
+		if(tokens[i].type == COLON) {
+			int at = (i) ? scanStatement(p, tokens, i, why) : 0;
+			return (at < 0) ? scanRest(p, tokens, n, i+1, why) : at;
+		}
+
+	int inp = 0;
+	for(int i = 0; i < n; i++)
+		if(isKeyword(tokens[i], KW_INPUT) && inp++)
+			return i;
+
+	if(tokens[0].type == SYMBOL) {
+		int eq = 1;
+		if(n > 1 && isKeyword(tokens[1], KW_LPAREN)) {
+			eq = matchClose(tokens, n, 1);
+			if(!eq)
+				return n;
+			int at = (eq == 2) ? -1 : scanRange(p, tokens, 2, eq);
+			if(at >= 0)
+				return at;
+			eq++;
+		}
+		if(eq >= n || !isKeyword(tokens[eq], KW_EQ))
+			return eq;
+		if(eq == 1 && n > 2 && isKeyword(tokens[2], KW_INPUT))
+			return (n == 3) ? -1 : scanRange(p, tokens, 3, n);
+		return scanRange(p, tokens, eq+1, n);
+	}
+	if(tokens[0].type == LABEL)
+		return (n == 1) ? -1 : 1;
+	if(tokens[0].type != KEYWORD)
+		return 0;
+
+	int i = 1;
+	switch(tokens[0].val.i) {
+	case KW_PRINT:
+		if(n > 1 && isKeyword(tokens[1], KW_HASH)) {
+			if(!scanFile(p, tokens, n, &i)
+					|| (i < n && !scanToken(tokens, n, &i, COMMA)))
+				return i;
+		}
+		while(i < n)
+			if(!scanOr(p, tokens, n, &i)
+					|| (i < n && !scanToken(tokens, n, &i, COMMA)))
+				return i;
+		return -1;
+	case KW_OPEN: {
+		int found = 0;
+		for(int j = 1; j < n && !found; j++)
+			if(isKeyword(tokens[j], KW_FOR))
+				found = j;
+		if(!found || found+4 >= n)
+			return n;
+		if(!isKeyword(tokens[found+1], KW_INPUT)
+				&& !isKeyword(tokens[found+1], KW_OUTPUT)
+				&& !isKeyword(tokens[found+1], KW_APPEND))
+			return found+1;
+		if(!isKeyword(tokens[found+2], KW_AS))
+			return found+2;
+		if(!isKeyword(tokens[found+3], KW_HASH))
+			return found+3;
+		int at = scanRange(p, tokens, 1, found);
+		return (at < 0) ? scanRange(p, tokens, found+4, n) : at;
+	}
+	case KW_CLOSE:
+		if(!scanFile(p, tokens, n, &i))
+			return i;
+		return (i == n) ? -1 : i;
+	case KW_LINE:
+		if(!scanKeyword(tokens, n, &i, KW_INPUT)
+				|| !scanFile(p, tokens, n, &i)
+				|| !scanToken(tokens, n, &i, COMMA))
+			return i;
+		if(i >= n || tokens[i].type != SYMBOL
+				|| !isStringName(tokens[i].val.s))
+			return i;
+		return (i+1 == n) ? -1 : i+1;
+	case KW_READ:
+	case KW_WRITE:
+		if(!scanFile(p, tokens, n, &i) || !scanToken(tokens, n, &i, COMMA))
+			return i;
+		if(i >= n || tokens[i].type != SYMBOL
+				|| isStringName(tokens[i].val.s))
+			return i;
+		i++;
+		if(!scanKeyword(tokens, n, &i, KW_LPAREN)
+				|| !scanKeyword(tokens, n, &i, KW_RPAREN))
+			return i;
+		return (i == n) ? -1 : i;
+	case KW_DELETE:
+		if(n < 5)
+			return n;
+		if(tokens[1].type != SYMBOL)
+			return 1;
+		if(!isKeyword(tokens[2], KW_LPAREN))
+			return 2;
+		if(!isKeyword(tokens[n-1], KW_RPAREN))
+			return n-1;
+		return scanRange(p, tokens, 3, n-1);
+	case KW_SNAPSHOT:
+		return scanRange(p, tokens, 1, n);
+	case KW_INPUT:
+	case KW_RETURN:
+		return (n == 1) ? -1 : scanRange(p, tokens, 1, n);
+	case KW_FOR: {
+		if(n < 2 || tokens[1].type != SYMBOL
+				|| isStringName(tokens[1].val.s))
+			return 1;
+		if(n < 3 || !isKeyword(tokens[2], KW_EQ))
+			return 2;
+		int found = 0;
+		for(int j = 3; j < n && !found; j++)
+			if(isKeyword(tokens[j], KW_TO))
+				found = j;
+		if(!found)
+			return n;
+		int at = scanRange(p, tokens, 3, found);
+		return (at < 0) ? scanRange(p, tokens, found+1, n) : at;
+	}
+	case KW_PARALLEL: {
+		if(n < 2 || !isKeyword(tokens[1], KW_FOR))
+			return 1;
+		int end = reductionStart(tokens, n);
+		int at = scanRest(p, tokens, end, 1, why);
+		if(at >= 0)
+			return at;
+		for(i = end; i < n; i += 2)
+			if(i+1 >= n || tokens[i+1].type != SYMBOL
+					|| isStringName(tokens[i+1].val.s))
+				return i+1;
+		return -1;
+	}
+	case KW_NEXT:
+		return (n == 1) ? -1 : 1;
+	case KW_GOTO:
+	case KW_GOSUB:
+		return scanTargets(p, tokens, n, 1, false, why);
+	case KW_DIM:
+		if(n == 4 && isKeyword(tokens[2], KW_AS)) {
+			if(tokens[1].type != SYMBOL)
+				return 1;
+			return isKeyword(tokens[3], KW_MAP) ? -1 : 3;
+		}
+		if(n < 5)
+			return n;
+		if(tokens[1].type != SYMBOL)
+			return 1;
+		if(!isKeyword(tokens[2], KW_LPAREN))
+			return 2;
+		if(!isKeyword(tokens[n-1], KW_RPAREN))
+			return n-1;
+		return scanRange(p, tokens, 3, n-1);
+	/* collectFunctions has checked the rest of these, but it only
+	 * looks at lines they start */
+	case KW_DEF:
+	case KW_FUNCTION:
+	case KW_SUB: {
+		if(n < 2)
+			return n;
+		Function *f = (tokens[1].type == SYMBOL)
+			? getFunction(p, tokens[1].val.s) : 0;
+		if(!f || getLine(p, f->line-1)->tokens != tokens) {
+			*why = "FUNCTIONS MUST START A LINE";
+			return 0;
+		}
+		return (f->def) ? scanRange(p, tokens, f->expression, n) : -1;
+	}
+	case KW_EXIT:
+		return -1;
+	case KW_RANDOMIZE:
+		return (n < 2) ? n : scanRange(p, tokens, 1, n);
+	case KW_END:
+		return (n == 2) ? -1 : (n < 2) ? n : 2;
+	case KW_CALL:
+		if(n < 2)
+			return n;
+		if(tokens[1].type != SYMBOL)
+			return 1;
+		if(!getFunction(p, tokens[1].val.s)) {
+			*why = "UNKNOWN FUNCTION";
+			return 1;
+		}
+		return (n == 2) ? -1 : scanRange(p, tokens, 1, n);
+	case KW_ON:
+		if(n < 2 || !isKeyword(tokens[1], KW_ERROR)) {
+			int found = onJump(tokens, n);
+			if(!found)
+				return n;
+			int at = scanRange(p, tokens, 1, found);
+			return (at < 0) ? scanTargets(p, tokens, n, found+1, true, why)
+				: at;
+		}
+		if(!scanKeyword(tokens, n, &i, KW_ERROR)
+				|| !scanKeyword(tokens, n, &i, KW_GOTO))
+			return i;
+		if(n == 4 && tokens[3].type == INTEGER && tokens[3].val.i == 0)
+			return -1;
+		return scanLabel(p, tokens, n, 3, why);
+	}
+	return 0;
+}
+
+/* scans lines from to to for syntax and type errors, reporting each
+ * with its column, and returns how many there were */
+int checkLines(Program *p, int from, int to) {
+	int line = p->line;
+	int errors = 0;
+	for(int i = from; i < to; i++) {
+		Line *l = getLine(p, i);
+		l->checked = true;
+		const char *why = "SYNTAX ERROR";
+		int at = scanStatement(p, l->tokens, l->length, &why);
+		p->line = i+1;
+		if(at >= 0) {
+			reportError(p, why, i, at);
+			errors++;
+		}
+		else
+			l->typed = checkStatement(p, l->tokens, l->length, &errors);
+	}
+	p->line = line;
+	return errors;
+}
+
+/* every line, before a run or --emit-c, so all the errors are listed
+ * before anything is printed. a line that runs without this, like one
+ * a command at the prompt jumps to, is checked when it first runs */
+void validateProgram(Program *p) {
+	if(checkLines(p, 0, p->num_lines))
+		stopProgram(p, RUN_ERROR);
+}
+
+/* ON expr GOTO|GOSUB targets: the value picks a target by position,
+ * and outside 1 to the number of targets the line carries on */
+int runOn(Program *p, Token *tokens, int n) {
+	int found = onJump(tokens, n);
+	syntaxAssert(p, found && (n-found)%2 == 0);
+	int k = expectInteger(p, evalExpression(p, tokens+1, found-1));
+	if(k < 1 || k > (n-found)/2)
+		return 0;
+	if(isKeyword(tokens[found], KW_GOSUB))
+		pushReturnLine(p, p->line);
+	p->line = jumpTarget(p, &tokens[found+2*k-1]);
+	return 1;
+}
+
+/* statements are dispatched on the opcode of their first keyword.
+ * returns 1 to jump to another line */
+int runLine(Program *p, Token *tokens, int n) {
+	if(n <= 0)
+		return 0;
+
+	/* ELSE, IF and REM decide on the rest of the line */
+	if(tokens[0].type == KEYWORD) {
+		switch(tokens[0].val.i) {
+		case KW_REM:
+			return 0;
+		case KW_ELSE:
+			if(!p->do_else)
+				return 0;
+			return runLine(p, tokens+1, n-1);
+		case KW_IF: {
+			int found = 0;
+			for(int i = 0; i < n && !found; i++)
+				if(isKeyword(tokens[i], KW_THEN))
+					found = i;
+			if(!found) {
+				runError(p, "EXPECT THEN AFTER IF\n");
+			}
+			Value v = evalExpression(p, tokens+1, found-1);
+			p->do_else = expectInteger(p, v) == 0;
+			if(p->trace)
+				traceEvent(p, (p->do_else) ? 'F' : 'T', 0);
+			if(p->do_else)
+				return 0;
+			return runLine(p, tokens+found+1, n-found-1);
+		}
+		}
+	}
+
+	/* where an INPUT would carry on from */
+	p->statement = tokens;
+	p->statement_n = n;
+
+	/* multiple statements on one line */
+	int multi = 0;
+	int mn = 0;
+
+	for(int i = 0; i < n && !multi; i++)
+		if(tokens[i].type == COLON)
+			multi = i;
+
+	if(multi) {
+		mn = n-multi-1;
+		n = multi;
+		multi++;
+	}
+
+	int inp = 0;
+	for(int i = 0; i < n; i++)
+		if(isKeyword(tokens[i], KW_INPUT))
+			if(inp++)
+				syntaxError(p);
+
+	if(tokens[0].type == SYMBOL) {
+		runAssignment(p, tokens, n);
+		if(multi)
+			return runLine(p, tokens+multi, mn);
+		return 0;
+	}
+
+	if(tokens[0].type == LABEL) {
+		syntaxAssert(p, n == 1);
+		return 0;
+	}
+
+	syntaxAssert(p, tokens[0].type == KEYWORD);
+
+	switch(tokens[0].val.i) {
+	case KW_PRINT: {
+		int i = 1;
+		FILE *fp = p->out;
+		if(n > 1 && isKeyword(tokens[1], KW_HASH)) {
+			fp = fileArgument(p, tokens, n, &i);
+			if(i < n) {
+				syntaxAssert(p, tokens[i].type == COMMA);
+				i++;
+			}
+		}
+		while(i < n) {
+			writeValue(fp, evalOr(p, tokens, n, &i, false));
+			if(i < n) {
+				syntaxAssert(p, tokens[i].type == COMMA);
+				i++;
+			}
+		}
+		fputc('\n', fp);
+		break;
+	}
+	case KW_OPEN:
+		openFile(p, tokens, n);
+		break;
+	case KW_CLOSE: {
+		int i = 1;
+		FILE *fp = fileArgument(p, tokens, n, &i);
+		syntaxAssert(p, i == n);
+		for(int j = 0; j < MAX_FILES; j++)
+			if(p->files[j] == fp)
+				p->files[j] = 0;
+		fclose(fp);
+		break;
+	}
+	case KW_LINE: {
+		syntaxAssert(p, n > 1 && isKeyword(tokens[1], KW_INPUT));
+		int i = 2;
+		FILE *fp = fileArgument(p, tokens, n, &i);
+		syntaxAssert(p, i+2 == n && tokens[i].type == COMMA);
+		syntaxAssert(p, tokens[i+1].type == SYMBOL);
+		char *identifier = tokens[i+1].val.s;
+		syntaxAssert(p, isStringName(identifier));
+
+		char *s = readLine(fp);
+		setStringVariable(p, identifier, (s) ? s : p->blank);
+		free(s);
+		break;
+	}
+	case KW_READ:
+	case KW_WRITE:
+		transferArray(p, tokens, n);
+		break;
+	case KW_DELETE: {
+		syntaxAssert(p, n >= 5 && tokens[1].type == SYMBOL);
+		syntaxAssert(p, isKeyword(tokens[2], KW_LPAREN));
+		syntaxAssert(p, isKeyword(tokens[n-1], KW_RPAREN));
+		Map *m = getMap(p, tokens[1].val.s);
+		if(!m) {
+			runError(p, "COULD NOT FIND %s\n", tokens[1].val.s);
+		}
+		deleteMapVal(p, m, evalExpression(p, tokens+3, n-4));
+		break;
+	}
+	case KW_SNAPSHOT: {
+		syntaxAssert(p, n > 1);
+		Value v = evalExpression(p, tokens+1, n-1);
+		writeState(p, expectString(p, v));
+		break;
+	}
+	case KW_INPUT:
+		if(n > 1 && !p->input) {
+			writeValue(p->out, evalExpression(p, tokens+1, n-1));
+			fputc('\n', p->out);
+		}
+		free(getInput(p));
+		break;
+	case KW_FOR: {
+		syntaxAssert(p, n >= 6);
+
+		int found = 0;
+		for(int i = 0; i < n && !found; i++)
+			if(isKeyword(tokens[i], KW_TO))
+				found = i;
+		if(!found) {
+			runError(p, "EXPECT TO AFTER FOR\n");
+		}
+
+		syntaxAssert(p, tokens[1].type == SYMBOL);
+		syntaxAssert(p, !isStringName(tokens[1].val.s));
+		syntaxAssert(p, isKeyword(tokens[2], KW_EQ));
+
+		int i1 = expectInteger(p, evalExpression(p, tokens+3, found-3));
+		int i2 = expectInteger(p, evalExpression(p, tokens+found+1,
+				n-found-1));
+
+		ForLoop f = (ForLoop) {
+			i1, i2, tokens[1].val.s, p->line,
+		};
+		pushForLoop(p, f);
+
+		setIntegerVariable(p, tokens[1].val.s, i1);
+		break;
+	}
+	case KW_NEXT: {
+		syntaxAssert(p, n == 1);
+		ForLoop f = popForLoop(p);
+
+		int i = getIntegerVariable(p, f.s);
+		bool g = true;
+		if(f.i1 < f.i2)
+			g = ++i > f.i2;
+		else if(f.i1 > f.i2)
+			g = --i < f.i2;
+		setIntegerVariable(p, f.s, i);
+
+		if(!g) {
+			pushForLoop(p, f);
+			p->line = f.line;
+			return 1;
+		}
+		break;
+	}
+	case KW_GOTO:
+		syntaxAssert(p, n == 2);
+		p->line = jumpTarget(p, &tokens[1]);
+		return 1;
+	case KW_GOSUB:
+		syntaxAssert(p, n == 2);
+		pushReturnLine(p, p->line);
+		p->line = jumpTarget(p, &tokens[1]);
+		return 1;
+	case KW_RETURN: {
+		/* leaving a function */
+		Frame *f = (p->num_frames) ? &p->frames[p->num_frames-1] : 0;
+		if(f && f->returnDepth == p->num_returnLines) {
+			if(n > 1) {
+				Value v = evalExpression(p, tokens+1, n-1);
+				/* a call in v may have moved the frames */
+				f = &p->frames[p->num_frames-1];
+				syntaxAssert(p, f->f->num_locals > f->f->num_params
+						&& strcmp(f->f->locals[f->f->num_params],
+						f->f->identifier) == 0);
+				if(!isInteger(v))
+					setStringVariable(p, f->f->identifier,
+							valueString(v));
+				else
+					setIntegerVariable(p, f->f->identifier,
+							valueInteger(v));
+			}
+			f->done = true;
+			return 1;
+		}
+
+		syntaxAssert(p, n == 1);
+		p->line = popReturnLine(p);
+		return 1;
+	}
+	case KW_DIM: {
+		if(n == 4 && isKeyword(tokens[2], KW_AS)) {
+			syntaxAssert(p, tokens[1].type == SYMBOL);
+			syntaxAssert(p, isKeyword(tokens[3], KW_MAP));
+			dimMap(p, tokens[1].val.s);
+			return 0;
+		}
+		syntaxAssert(p, n >= 5);
+		syntaxAssert(p, tokens[1].type == SYMBOL);
+		syntaxAssert(p, isKeyword(tokens[2], KW_LPAREN));
+		syntaxAssert(p, isKeyword(tokens[n-1], KW_RPAREN));
+		int size = expectInteger(p, evalExpression(p, tokens+3, n-4));
+		if(size <= 0) {
+			runError(p, "ARRAY SIZE MUST BE > 0\n");
+		}
+
+		if(isStringName(tokens[1].val.s))
+			dimStringArray(p, tokens[1].val.s, size);
+		else
+			dimIntegerArray(p, tokens[1].val.s, size);
+		return 0;
+	}
+	case KW_DEF:
+		return 0;
+	case KW_FUNCTION:
+	case KW_SUB:
+		/* skip over the body */
+		syntaxAssert(p, n >= 2 && tokens[1].type == SYMBOL
+				&& getFunction(p, tokens[1].val.s));
+		p->line = getFunction(p, tokens[1].val.s)->end;
+		return 1;
+	case KW_END:
+		syntaxAssert(p, n == 2 && p->num_frames);
+		p->frames[p->num_frames-1].done = true;
+		return 1;
+	case KW_CALL: {
+		syntaxAssert(p, n >= 2 && tokens[1].type == SYMBOL);
+		Function *f = getFunction(p, tokens[1].val.s);
+		if(!f) {
+			runError(p, "COULD NOT FIND %s\n", tokens[1].val.s);
+		}
+		if(n == 2)
+			callFunction(p, f, 0, 0);
+		else
+			evalExpression(p, tokens+1, n-1);
+		break;
+	}
+	case KW_PARALLEL:
+		runParallel(p, tokens, n);
+		return 1;
+	case KW_ON:
+		if(n < 2 || !isKeyword(tokens[1], KW_ERROR)) {
+			if(runOn(p, tokens, n))
+				return 1;
+			break;
+		}
+		/* ON ERROR GOTO label, or ON ERROR GOTO 0 to clear it */
+		syntaxAssert(p, n == 4 && isKeyword(tokens[1], KW_ERROR));
+		syntaxAssert(p, isKeyword(tokens[2], KW_GOTO));
+		if(tokens[3].type == INTEGER && tokens[3].val.i == 0)
+			p->trap = 0;
+		else {
+			syntaxAssert(p, tokens[3].type == SYMBOL);
+			p->trap = getLabelLine(p, tokens[3].val.s);
+		}
+		break;
+	case KW_RANDOMIZE:
+		p->seed = mixSeed(expectInteger(p, evalExpression(p, tokens+1,
+				n-1)));
+		break;
+	case KW_EXIT:
+		stopProgram(p, RUN_DONE);
+	default:
+		syntaxError(p);
+	}
+
+	if(multi)
+		return runLine(p, tokens+multi, mn);
+	return 0;
+}
+
+/* runs the lines after p->line until the end of the program, or until
+ * the function that was called on entry returns */
+void runLines(Program *p) {
+	int depth = p->num_frames;
+	while(p->line < p->num_lines || p->resume) {
+		if(depth && p->frames[depth-1].done)
+			return;
+
+		/* the rest of a line that stopped for INPUT */
+		Token *tokens = p->resume;
+		int n = p->resume_n;
+		p->resume = 0;
+		if(!tokens) {
+			Line *l = getLine(p, p->line++);
+			if(!l->checked && checkLines(p, p->line-1, p->line))
+				stopProgram(p, RUN_ERROR);
+			p->steps++;
+			/* compiled lines skip the IFs a trace records */
+			if(p->jit && !p->trace && !p->num_frames
+					&& runCompiled(p, l))
+				continue;
+			tokens = l->tokens;
+			n = l->length;
+		}
+
+		int jumped = runLine(p, tokens, n);
+		releaseTemps(p);
+		if(!jumped)
+			continue;
+		if(p->trace)
+			traceEvent(p, 'J', p->line);
+
+		checkBudgets(p);
+		/* only yield in the main program, where nothing of the run is
+		 * left on the C stack */
+		if(p->slice && !depth && p->steps >= p->yield_at) {
+			p->status = RUN_YIELD;
+			return;
+		}
+	}
+}
+
+/* ON ERROR GOTO: a runtime error carries on at the handler with ERL
+ * holding the line that failed. syntax and type errors never get here,
+ * since validateProgram stops the run before it starts. the stacks are
+ * dropped and the trap is spent, so an error inside the handler ends
+ * the run */
+void trapError(Program *p) {
+	/* a handler that fails straight away would never jump */
+	checkBudgets(p);
+	int trap = p->trap;
+	int line = p->line;
+	resetProgram(p);
+	p->status = RUN_DONE;
+	char erl[] = "ERL";
+	setIntegerVariable(p, erl, lineNumber(p, line));
+	p->line = trap;
+}
+
+/* for hosts: runs from p->line until the program ends, yields or is
+ * stopped, and returns how it ended. after RUN_YIELD, calling it again
+ * carries on. errors come back as RUN_ERROR instead of exiting */
+int resumeProgram(Program *p) {
+	jmp_buf recover;
+	jmp_buf *outer = p->recover, *outer_trapping = p->trapping;
+	p->recover = &recover;
+	p->trapping = &recover;
+	p->status = RUN_DONE;
+	if(p->max_time && !p->deadline)
+		p->deadline = milliseconds()+p->max_time;
+	p->yield_at = p->steps+p->slice;
+
+	for(;;) {
+		if(setjmp(recover) == 0)
+			runLines(p);
+		if(p->status != RUN_ERROR || !p->trap)
+			break;
+		trapError(p);
+	}
+	if(p->status != RUN_YIELD && p->status != RUN_INPUT)
+		resetProgram(p);
+
+	p->recover = outer;
+	p->trapping = outer_trapping;
+	return p->status;
+}
+
+int runProgram(Program *p) {
+	p->line = 0;
+	return resumeProgram(p);
+}
+
+/* prints the lines numbered from to to */
+void listProgram(Program *p, int from, int to) {
+	int i = findLine(p, from);
+	for(i = (i < 0) ? -1-i : i; i < p->num_lines
+			&& p->lines[i].number <= to; i++)
+		printf("%d %s\n", p->lines[i].number, p->lines[i].text);
+}
+
+bool isBlank(const char *s) {
+	while(charClass[(unsigned char)*s] == C_SPACE)
+		s++;
+	return !*s;
+}
+
+/* runs one line typed at the prompt, false to leave. cmd holds the
+ * line while it runs so it can be freed after an error */
+bool runCommand(Program *p, char *s, Line *cmd) {
+	char *e;
+	int n = strtol(s, &e, 10);
+
+	/* numbered lines replace that line, or delete it if empty */
+	if(e != s) {
+		if(*e == ' ')
+			e++;
+		if(n < 1)
+			printf("INVALID LINE %d\n", n);
+		else if(!isBlank(e))
+			setLine(p, n, e);
+		else if(findLine(p, n) >= 0)
+			deleteLine(p, findLine(p, n)+1);
+		return true;
+	}
+
+	*cmd = newLine(s, strlen(s));
+	char w[10];
+	firstWord(cmd, w, sizeof(w));
+	const char *rest = s;
+	while(charClass[(unsigned char)*rest] == C_SPACE)
+		rest++;
+	rest += strlen(w);
+
+	if(strcmp(w, "RUN") == 0 && isBlank(rest)) {
+		validateProgram(p);
+		runProgram(p);
+		return true;
+	}
+	if(strcmp(w, "LIST") == 0) {
+		int from = 1, to = INT_MAX;
+		int m = sscanf(rest, "%d %d", &from, &to);
+		if(m == 1)
+			to = from;
+		listProgram(p, from, to);
+		return true;
+	}
+	if(strcmp(w, "CLEAR") == 0 && isBlank(rest)) {
+		clearVariables(p);
+		return true;
+	}
+	if(strcmp(w, "INSERT") == 0) {
+		n = strtol(rest, &e, 10);
+		if(e == rest || n < 1) {
+			printf("INSERT NEEDS A LINE NUMBER\n");
+			return true;
+		}
+		if(*e == ' ')
+			e++;
+		insertLine(p, n, e);
+		return true;
+	}
+	if(strcmp(w, "EXIT") == 0 && isBlank(rest))
+		return false;
+
+	lexLine(cmd);
+
+	/* a label replaces the line after it, or adds both to the end */
+	if(cmd->length && cmd->tokens[0].type == LABEL) {
+		char *after = strchr(s, ':')+1;
+		int line = 0;
+		for(int i = 0; i < p->num_labels && !line; i++)
+			if(strcmp(p->labels[i].identifier,
+					cmd->tokens[0].val.s) == 0)
+				line = p->labels[i].val.i;
+		if(!line) {
+			char c = *after;
+			*after = 0;
+			setLine(p, nextNumber(p), s);
+			*after = c;
+			line = p->num_lines;
+		}
+		while(charClass[(unsigned char)*after] == C_SPACE)
+			after++;
+		if(*after)
+			setLine(p, (line < p->num_lines) ?
+					p->lines[line].number : nextNumber(p), after);
+		return true;
+	}
+
+	/* anything else runs at once, and may jump into the program */
+	p->line = p->num_lines;
+	p->direct = true;
+	bool jumped = runLine(p, cmd->tokens, cmd->length);
+	p->direct = false;
+	if(jumped)
+		runLines(p);
+	releaseTemps(p);
+	return true;
+}
+
+/* with no file, lines are read from a prompt. variables, lines and
+ * their compiled code stay loaded between commands */
+void runRepl(Program *p) {
+	jmp_buf recover;
+	p->recover = &recover;
+	Line *cmd = malloc(sizeof(Line));
+	printf("BASIC Interpreter - tdwsl 2022\n");
+	printf("READY\n");
+
+	bool running = true;
+	while(running) {
+		printf("> ");
+		fflush(stdout);
+		char *s = readLine(stdin);
+		if(!s)
+			break;
+		/* budgets apply to each command */
+		p->steps = 0;
+		p->deadline = (p->max_time) ? milliseconds()+p->max_time : 0;
+
+		*cmd = (Line){0};
+		if(setjmp(recover) == 0)
+			running = runCommand(p, s, cmd);
+		if(cmd->text)
+			freeLine(cmd);
+		resetProgram(p);
+		free(s);
+	}
+
+	free(cmd);
+	p->recover = 0;
+}
+
+/* where a line number from before a reload ends up. lines run from 0
+ * to n, n being the end. the first prefix lines and the last suffix
+ * lines are unchanged, and anything between goes to the first changed
+ * line */
+int movedLine(int line, int n, int new_n, int prefix, int suffix) {
+	if(line <= prefix)
+		return line;
+	if(line >= n-suffix)
+		return line+new_n-n;
+	return prefix;
+}
+
+/* puts the file's new text in place of the program without stopping
+ * the run. lines that didn't change keep their tokens and compiled
+ * code, the run and its return and FOR stacks move with the lines they
+ * were on, and variables are left alone. a FOR whose own line changed
+ * is dropped with the loops inside it. if the new text doesn't load,
+ * the old program carries on */
+void reloadProgram(Program *p, const char *filename) {
+	char *text = readFile(filename);
+	if(!text)
+		return;
+	Program *q = newProgram();
+	jmp_buf recover;
+	q->recover = &recover;
+	if(setjmp(recover)) {
+		printf("KEEPING THE OLD %s\n", filename);
+		freeProgram(q);
+		free(text);
+		return;
+	}
+	loadString(q, text);
+
+	int n = p->num_lines, new_n = q->num_lines;
+	int prefix = 0, suffix = 0;
+	while(prefix < n && prefix < new_n && strcmp(p->lines[prefix].text,
+			q->lines[prefix].text) == 0)
+		prefix++;
+	while(suffix < n-prefix && suffix < new_n-prefix
+			&& strcmp(p->lines[n-1-suffix].text,
+			q->lines[new_n-1-suffix].text) == 0)
+		suffix++;
+	/* only the changed lines need checking */
+	if(checkLines(q, prefix, new_n-suffix))
+		stopProgram(q, RUN_ERROR);
+	free(text);
+
+	/* the new lines, taking the unchanged ones from p */
+	Line *lines = malloc(sizeof(Line)*(new_n+1));
+	for(int i = 0; i < new_n; i++) {
+		Line *from = (i < prefix) ? &p->lines[i]
+			: (i >= new_n-suffix) ? &p->lines[i-new_n+n]
+			: &q->lines[i];
+		lines[i] = *from;
+		*from = (Line){0};
+	}
+	for(int i = prefix; i < n-suffix; i++)
+		freeLine(&p->lines[i]);
+	free(p->lines);
+	p->lines = lines;
+	p->num_lines = new_n;
+	freeProgram(q);
+
+	for(int i = 0; i < p->num_forLoops; i++) {
+		int line = p->forLoops[i].line-1;
+		if(line >= prefix && line < n-suffix) {
+			p->num_forLoops = i;
+			break;
+		}
+		p->forLoops[i].line = movedLine(p->forLoops[i].line, n, new_n,
+				prefix, suffix);
+	}
+	for(int i = 0; i < p->num_returnLines; i++)
+		p->returnLines[i] = movedLine(p->returnLines[i], n, new_n,
+				prefix, suffix);
+	if(p->trap)
+		p->trap = movedLine(p->trap, n, new_n, prefix, suffix);
+
+	/* the rest of a line waiting for INPUT is in that line's tokens */
+	if(p->resume && p->line-1 >= prefix && p->line-1 < n-suffix) {
+		p->resume = 0;
+		p->line = prefix;
+	}
+	else
+		p->line = movedLine(p->line, n, new_n, prefix, suffix);
+
+	int line = p->line;
+	indexProgram(p);
+	p->line = line;
+	printf("\nRELOADED %s\n", filename);
+}
+
+/* true if the watched directory saw name written or moved in */
+bool fileSaved(int fd, const char *name) {
+	union {
+		struct inotify_event e;
+		char c[4096];
+	} buf;
+	bool saved = false;
+	long len;
+	while((len = read(fd, &buf, sizeof(buf))) > 0)
+		for(long i = 0; i < len;) {
+			struct inotify_event *e = (struct inotify_event*)(buf.c+i);
+			if(e->len && strcmp(e->name, name) == 0)
+				saved = true;
+			i += sizeof(struct inotify_event)+e->len;
+		}
+	return saved;
+}
+
+/* --watch runs the file and reloads it each time it is saved. the run
+ * yields every WATCH_SLICE lines, and INPUT waits in poll along with
+ * the watch, so a save is noticed whichever the program is doing.
+ * editors often save by renaming a new file over the old one, so it is
+ * the directory that is watched */
+int watchProgram(Program *p, const char *filename) {
+	const char *name = strrchr(filename, '/');
+	char *dir = (name) ? strndup(filename, name-filename+1) : strdup(".");
+	name = (name) ? name+1 : filename;
+
+	int fd = inotify_init1(IN_NONBLOCK);
+	if(fd < 0 || inotify_add_watch(fd, dir, IN_CLOSE_WRITE|IN_MOVED_TO) < 0) {
+		printf("failed to watch %s\n", filename);
+		free(dir);
+		return RUN_ERROR;
+	}
+	free(dir);
+
+	p->slice = WATCH_SLICE;
+	p->async_input = true;
+	int status;
+	for(;;) {
+		status = resumeProgram(p);
+		if(status == RUN_YIELD) {
+			if(fileSaved(fd, name))
+				reloadProgram(p, filename);
+			continue;
+		}
+		if(status != RUN_INPUT)
+			break;
+
+		/* other files in the directory don't end the wait */
+		fflush(p->out);
+		struct pollfd fds[2] = {{0, POLLIN, 0}, {fd, POLLIN, 0}};
+		for(;;) {
+			poll(fds, 2, -1);
+			if(fds[1].revents && fileSaved(fd, name)) {
+				reloadProgram(p, filename);
+				break;
+			}
+			if(fds[0].revents) {
+				char *s = readLine(stdin);
+				provideInput(p, (s) ? s : "");
+				free(s);
+				break;
+			}
+		}
+	}
+	close(fd);
+	return status;
+}
+
+/* --emit-c translates a loaded program to a standalone C file. variables
+ * become C globals, function locals become C locals that shadow them,
+ * labels become goto targets, and FOR/NEXT and GOSUB/RETURN jump back
+ * through a switch over ids kept on small runtime stacks */
+
+const char *cRuntime[] = {
+	"#include <stdio.h>",
+	"#include <stdlib.h>",
+	"#include <string.h>",
+	"",
+	"typedef struct { int *v; int n; const char *name; } bas_iarray;",
+	"typedef struct { char **v; int n; const char *name; } bas_sarray;",
+	"typedef struct { int *v; int i1, i2, id; } bas_loop;",
+	"",
+	"static int bas_else, bas_id;",
+	"static bas_loop *bas_loops;",
+	"static int bas_nloops, bas_maxloops;",
+	"static int *bas_returns;",
+	"static int bas_nreturns, bas_maxreturns;",
+	"static char *bas_temps[16];",
+	"static int bas_ntemp;",
+	"",
+	"static void bas_error(int line) {",
+	"\tprintf(\"SYNTAX ERROR AT LINE %d\\n\", line);",
+	"\texit(1);",
+	"}",
+	"",
+	"static const char *bas_s(const char *s) {",
+	"\treturn s ? s : \"\";",
+	"}",
+	"",
+	"static void bas_set(char **d, const char *s) {",
+	"\tchar *n = malloc(strlen(s)+1);",
+	"\tstrcpy(n, s);",
+	"\tfree(*d);",
+	"\t*d = n;",
+	"}",
+	"",
+	"/* strings returned by functions stay valid for a while */",
+	"static const char *bas_temp(char *s) {",
+	"\tfree(bas_temps[bas_ntemp]);",
+	"\tbas_temps[bas_ntemp] = s;",
+	"\tbas_ntemp = (bas_ntemp+1)%16;",
+	"\treturn s;",
+	"}",
+	"",
+	"static void bas_idim(bas_iarray *a, int n, int line) {",
+	"\tif(n <= 0) {",
+	"\t\tprintf(\"ARRAY SIZE MUST BE > 0\\n\");",
+	"\t\tbas_error(line);",
+	"\t}",
+	"\tfree(a->v);",
+	"\ta->v = calloc(n, sizeof(int));",
+	"\ta->n = n;",
+	"}",
+	"",
+	"static void bas_sdim(bas_sarray *a, int n, int line) {",
+	"\tif(n <= 0) {",
+	"\t\tprintf(\"ARRAY SIZE MUST BE > 0\\n\");",
+	"\t\tbas_error(line);",
+	"\t}",
+	"\tfor(int i = 0; i < a->n; i++)",
+	"\t\tfree(a->v[i]);",
+	"\tfree(a->v);",
+	"\ta->v = calloc(n, sizeof(char*));",
+	"\ta->n = n;",
+	"}",
+	"",
+	"static int *bas_iat(bas_iarray *a, int d, int line) {",
+	"\tif(!a->v) {",
+	"\t\tprintf(\"COULD NOT FIND %s\\n\", a->name);",
+	"\t\tbas_error(line);",
+	"\t}",
+	"\tif(d < 1 || d > a->n) {",
+	"\t\tprintf(\"INVALID ARRAY INDEX %d\\n\", d);",
+	"\t\tbas_error(line);",
+	"\t}",
+	"\treturn &a->v[d-1];",
+	"}",
+	"",
+	"static char **bas_sat(bas_sarray *a, int d, int line) {",
+	"\tif(!a->v) {",
+	"\t\tprintf(\"COULD NOT FIND %s\\n\", a->name);",
+	"\t\tbas_error(line);",
+	"\t}",
+	"\tif(d < 1 || d > a->n) {",
+	"\t\tprintf(\"INVALID INDEX %d\\n\", d);",
+	"\t\tbas_error(line);",
+	"\t}",
+	"\treturn &a->v[d-1];",
+	"}",
+	"",
+	"static void bas_for(int *v, int i1, int i2, int id) {",
+	"\tif(bas_nloops == bas_maxloops) {",
+	"\t\tbas_maxloops += 20;",
+	"\t\tbas_loops = realloc(bas_loops, bas_maxloops*sizeof(bas_loop));",
+	"\t}",
+	"\tbas_loops[bas_nloops++] = (bas_loop){v, i1, i2, id};",
+	"\t*v = i1;",
+	"}",
+	"",
+	"/* returns the id of the loop to jump back to, or -1 when done */",
+	"static int bas_next(int line) {",
+	"\tif(!bas_nloops)",
+	"\t\tbas_error(line);",
+	"\tbas_loop *l = &bas_loops[bas_nloops-1];",
+	"\tif(l->i1 < l->i2) {",
+	"\t\tif(++(*l->v) <= l->i2)",
+	"\t\t\treturn l->id;",
+	"\t}",
+	"\telse if(l->i1 > l->i2) {",
+	"\t\tif(--(*l->v) >= l->i2)",
+	"\t\t\treturn l->id;",
+	"\t}",
+	"\tbas_nloops--;",
+	"\treturn -1;",
+	"}",
+	"",
+	"static void bas_gosub(int id) {",
+	"\tif(bas_nreturns == bas_maxreturns) {",
+	"\t\tbas_maxreturns += 20;",
+	"\t\tbas_returns = realloc(bas_returns, bas_maxreturns*sizeof(int));",
+	"\t}",
+	"\tbas_returns[bas_nreturns++] = id;",
+	"}",
+	"",
+	"static int bas_return(int line) {",
+	"\tif(!bas_nreturns)",
+	"\t\tbas_error(line);",
+	"\treturn bas_returns[--bas_nreturns];",
+	"}",
+	"",
+	"static char *bas_input(void) {",
+	"\tprintf(\"?\");",
+	"\tint max = 30, len = 0, c;",
+	"\tchar *s = malloc(max);",
+	"\twhile((c = getchar()) != EOF && c != '\\n') {",
+	"\t\ts[len++] = c;",
+	"\t\tif(len > max-10) {",
+	"\t\t\tmax += 20;",
+	"\t\t\ts = realloc(s, max);",
+	"\t\t}",
+	"\t}",
+	"\ts[len] = 0;",
+	"\treturn s;",
+	"}",
+	"",
+	"/* the interpreter's math functions, RND drawing the same numbers */",
+	"static unsigned long long bas_seed;",
+	"",
+	"static unsigned long long bas_mix(int n) {",
+	"\tunsigned long long z = (unsigned)n+0x9E3779B97F4A7C15ull;",
+	"\tz = (z ^ (z >> 30))*0xBF58476D1CE4E5B9ull;",
+	"\tz = (z ^ (z >> 27))*0x94D049BB133111EBull;",
+	"\tz ^= z >> 31;",
+	"\treturn (z) ? z : 1;",
+	"}",
+	"",
+	"static void bas_invalid(const char *f, int line) {",
+	"\tprintf(\"INVALID ARGUMENT TO %s\\n\", f);",
+	"\tbas_error(line);",
+	"}",
+	"",
+	"static int bas_rnd(int n, int line) {",
+	"\tif(n <= 0)",
+	"\t\tbas_invalid(\"RND\", line);",
+	"\tif(!bas_seed)",
+	"\t\tbas_seed = bas_mix(0);",
+	"\tunsigned long long x = bas_seed;",
+	"\tx ^= x >> 12;",
+	"\tx ^= x << 25;",
+	"\tx ^= x >> 27;",
+	"\tbas_seed = x;",
+	"\treturn ((x*0x2545F4914F6CDD1Dull >> 32)*n) >> 32;",
+	"}",
+	"",
+	"static int bas_abs(int i, int line) {",
+	"\treturn (i < 0) ? -(unsigned)i : i;",
+	"}",
+	"",
+	"static int bas_sqr(int i, int line) {",
+	"\tif(i < 0)",
+	"\t\tbas_invalid(\"SQR\", line);",
+	"\tunsigned x = i, r = 0, bit = 1u << 30;",
+	"\twhile(bit > x)",
+	"\t\tbit >>= 2;",
+	"\tfor(; bit; bit >>= 2) {",
+	"\t\tif(x >= r+bit) {",
+	"\t\t\tx -= r+bit;",
+	"\t\t\tr = (r >> 1)+bit;",
+	"\t\t}",
+	"\t\telse",
+	"\t\t\tr >>= 1;",
+	"\t}",
+	"\treturn r;",
+	"}",
+	"",
+	"static int bas_shl(int i, int n, int line) {",
+	"\tif(n < 0)",
+	"\t\tbas_invalid(\"SHL\", line);",
+	"\treturn (n >= 32) ? 0 : (int)((unsigned)i << n);",
+	"}",
+	"",
+	"static int bas_shr(int i, int n, int line) {",
+	"\tif(n < 0)",
+	"\t\tbas_invalid(\"SHR\", line);",
+	"\treturn (n >= 32) ? 0 : (int)((unsigned)i >> n);",
+	"}",
+	"",
+	"static int bas_min(int a, int b, int line) {",
+	"\treturn (a < b) ? a : b;",
+	"}",
+	"",
+	"static int bas_max(int a, int b, int line) {",
+	"\treturn (a > b) ? a : b;",
+	"}",
+	"",
+	"/* arithmetic wraps like doOp's, and / and MOD fail the same way */",
+	"static int bas_neg(int a) {",
+	"\treturn (int)-(unsigned)a;",
+	"}",
+	"",
+	"static int bas_div(int a, int b, int line) {",
+	"\tif(b == 0) {",
+	"\t\tprintf(\"DIVISION BY ZERO\\n\");",
+	"\t\tbas_error(line);",
+	"\t}",
+	"\treturn (b == -1) ? bas_neg(a) : a / b;",
+	"}",
+	"",
+	"static int bas_mod(int a, int b, int line) {",
+	"\tif(b == 0) {",
+	"\t\tprintf(\"DIVISION BY ZERO\\n\");",
+	"\t\tbas_error(line);",
+	"\t}",
+	"\treturn (b == -1) ? 0 : a % b;",
+	"}",
+	"",
+	"static int bas_number(void) {",
+	"\tfor(;;) {",
+	"\t\tchar *s = bas_input(), *e;",
+	"\t\tlong long d = strtoll(s, &e, 10);",
+	"\t\twhile(*e == ' ' || *e == '\\t' || *e == '\\r')",
+	"\t\t\te++;",
+	"\t\tint ok = e != s && !*e && d >= -2147483648ll",
+	"\t\t\t&& d <= 2147483647ll;",
+	"\t\tfree(s);",
+	"\t\tif(ok || feof(stdin))",
+	"\t\t\treturn (ok) ? d : 0;",
+	"\t\tprintf(\"NOT A NUMBER\\n\");",
+	"\t}",
+	"}",
+	0,
+};
+
+typedef struct emitter {
+	Program *p;
+	FILE *fp;
+	Function *f;
+	int ids;
+	int *pending;
+	int num_pending;
+	int *fors;
+	int num_fors;
+	int *gosubs;
+	int num_gosubs;
+	bool *numbered; /* lines jumped to by number, which need a C label */
+} Emitter;
+
+char *formatString(const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	int len = vsnprintf(0, 0, fmt, args);
+	va_end(args);
+
+	char *s = malloc(len+1);
+	va_start(args, fmt);
+	vsnprintf(s, len+1, fmt, args);
+	va_end(args);
+	return s;
+}
+
+/* identifiers get a prefix per kind, $ becomes _S */
+char *mangle(const char *prefix, const char *identifier) {
+	int max = 20, len = 0;
+	char *s = malloc(max);
+	s[0] = 0;
+	for(const char *c = prefix; *c; c++)
+		s = addChar(s, &len, &max, *c);
+	for(const char *c = identifier; *c; c++) {
+		if((*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9')) {
+			s = addChar(s, &len, &max, *c);
+			continue;
+		}
+		char h[4];
+		if(*c == '$')
+			strcpy(h, "_S");
+		else
+			sprintf(h, "_%02X", (unsigned char)*c);
+		for(char *d = h; *d; d++)
+			s = addChar(s, &len, &max, *d);
+	}
+	return s;
+}
+
+void cannotCompile(Program *p, const char *why) {
+	runError(p, "CANNOT COMPILE %s\n", why);
 }
 
-void pushReturnLine(Program *p, int line) {
-	p->returnLines[p->num_returnLines++] = line;
-	if(p->num_returnLines > p->max_returnLines-10) {
-		p->max_returnLines += 20;
-		p->returnLines = realloc(p->returnLines,
-				p->max_returnLines*sizeof(int));
-	}
+/* coerces a C expression to int the way doOp does */
+char *emitInteger(char *s, int type) {
+	if(type == INTEGER)
+		return s;
+	char *r = formatString("((int)strlen(%s))", s);
+	free(s);
+	return r;
 }
 
-int popReturnLine(Program *p) {
-	syntaxAssert(p, p->num_returnLines != 0);
-	return p->returnLines[--(p->num_returnLines)];
-}
+char *emitOr(Emitter *e, Token *tokens, int n, int *i, int *type);
 
-/* returns 1 to jump to another line */
-int runLine(Program *p, Token *tokens, int n) {
-	if(n <= 0)
-		return 0;
+char *emitPrimary(Emitter *e, Token *tokens, int n, int *i, int *type) {
+	Program *p = e->p;
+	syntaxAssert(p, *i < n);
+	Token t = tokens[(*i)++];
 
-	if(tokens[0].type == KEYWORD) {
-		if(strcmp(tokens[0].val.cs, "ELSE") == 0) {
-			if(p->do_else) {
-				tokens++;
-				n--;
+	if(t.type == INTEGER) {
+		*type = INTEGER;
+		return formatString("%d", t.val.i);
+	}
+
+	if(t.type == STRING) {
+		int max = 20, len = 0;
+		char *s = malloc(max);
+		s = addChar(s, &len, &max, '"');
+		for(char *c = t.val.s; *c; c++) {
+			if(*c == '"' || *c == '\\')
+				s = addChar(s, &len, &max, '\\');
+			if((unsigned char)*c < ' ') {
+				char o[5];
+				sprintf(o, "\\%03o", (unsigned char)*c);
+				for(char *d = o; *d; d++)
+					s = addChar(s, &len, &max, *d);
 			}
 			else
-				return 0;
+				s = addChar(s, &len, &max, *c);
 		}
-		else if(strcmp(tokens[0].val.cs, "REM") == 0)
-			return 0;
+		s = addChar(s, &len, &max, '"');
+		*type = STRING;
+		return s;
 	}
 
-	/* multiple statements on one line */
-	int multi = 0;
-	int mn;
+	if(isKeyword(t, KW_LPAREN)) {
+		char *s = emitOr(e, tokens, n, i, type);
+		syntaxAssert(p, *i < n && isKeyword(tokens[*i], KW_RPAREN));
+		(*i)++;
+		char *r = formatString("(%s)", s);
+		free(s);
+		return r;
+	}
 
-	for(int i = 0; i < n && !multi; i++)
-		if(tokens[i].type == COLON)
-			multi = i;
+	if(isKeyword(t, KW_EOF))
+		cannotCompile(p, "FILE I/O");
+	if(isKeyword(t, KW_COUNT) || isKeyword(t, KW_HAS) || isKeyword(t, KW_KEY))
+		cannotCompile(p, "MAP");
+
+	/* math functions are bas_ and their name in lower case, with the
+	 * line last for errors. MIN and MAX nest */
+	if(t.type == KEYWORD && mathArity(t.val.i)) {
+		int kw = t.val.i;
+		bool variadic = kw == KW_MIN || kw == KW_MAX;
+		char name[16];
+		int len = 0;
+		for(const char *c = keywords[kw]; *c; c++)
+			name[len++] = *c-'A'+'a';
+		name[len] = 0;
+
+		syntaxAssert(p, *i < n && isKeyword(tokens[(*i)++], KW_LPAREN));
+		char *s = 0;
+		int num_args = 0;
+		for(;;) {
+			int at;
+			char *a = emitOr(e, tokens, n, i, &at);
+			syntaxAssert(p, at == INTEGER);
+			char *r = (!num_args) ? a
+				: (variadic) ? formatString("bas_%s(%s, %s, %d)", name,
+						s, a, p->line)
+				: formatString("%s, %s", s, a);
+			if(num_args++) {
+				free(s);
+				free(a);
+			}
+			s = r;
+			if(*i < n && tokens[*i].type == COMMA)
+				(*i)++;
+			else
+				break;
+		}
+		syntaxAssert(p, *i < n && isKeyword(tokens[(*i)++], KW_RPAREN));
+		if(num_args != mathArity(kw) && !(variadic && num_args > 2))
+			cannotCompile(p, "FUNCTION ARGUMENTS");
+		*type = INTEGER;
+		if(variadic)
+			return s;
+		char *r = formatString("bas_%s(%s, %d)", name, s, p->line);
+		free(s);
+		return r;
+	}
 
-	if(multi) {
-		mn = n-multi-1;
-		n = multi;
-		multi++;
+	syntaxAssert(p, t.type == SYMBOL);
+	*type = isStringName(t.val.s) ? STRING : INTEGER;
+
+	Function *f;
+	if(*i < n && isKeyword(tokens[*i], KW_LPAREN)
+			&& (f = getFunction(p, t.val.s))) {
+		(*i)++;
+		char *s = mangle("fn_", f->identifier);
+		int num_args = 0;
+		while(*i < n && !isKeyword(tokens[*i], KW_RPAREN)) {
+			int at;
+			char *a = emitOr(e, tokens, n, i, &at);
+			if(num_args >= f->num_params || at != (isStringName(
+					f->locals[num_args]) ? STRING : INTEGER))
+				cannotCompile(p, "FUNCTION ARGUMENTS");
+			char *r = formatString("%s%s%s", s,
+					(num_args++) ? ", " : "(", a);
+			free(s);
+			free(a);
+			s = r;
+			if(*i < n && tokens[*i].type == COMMA)
+				(*i)++;
+			else
+				break;
+		}
+		syntaxAssert(p, *i < n && isKeyword(tokens[*i], KW_RPAREN));
+		(*i)++;
+		if(num_args != f->num_params)
+			cannotCompile(p, "FUNCTION ARGUMENTS");
+		char *r = formatString("%s%s)", s, (num_args) ? "" : "(");
+		free(s);
+		return r;
 	}
 
-	int inp = 0;
-	for(int i = 0; i < n; i++)
-		if(tokens[i].type == KEYWORD)
-			if(strcmp(tokens[i].val.cs, "INPUT") == 0)
-				if(inp++)
-					syntaxError(p);
+	if(*i < n && isKeyword(tokens[*i], KW_LPAREN)) {
+		(*i)++;
+		int dt;
+		char *d = emitOr(e, tokens, n, i, &dt);
+		syntaxAssert(p, *i < n && isKeyword(tokens[*i], KW_RPAREN));
+		syntaxAssert(p, dt == INTEGER);
+		(*i)++;
+		char *a = mangle((*type == STRING) ? "sa_" : "a_", t.val.s);
+		char *r;
+		if(*type == STRING)
+			r = formatString("bas_s(*bas_sat(&%s, %s, %d))",
+					a, d, p->line);
+		else
+			r = formatString("(*bas_iat(&%s, %s, %d))",
+					a, d, p->line);
+		free(a);
+		free(d);
+		return r;
+	}
 
-	/* variable assignments */
-	if(tokens[0].type == SYMBOL) {
-		syntaxAssert(p, n >= 3);
-		syntaxAssert(p, tokens[1].type == KEYWORD);
+	if(*type == STRING) {
+		char *v = mangle("s_", t.val.s);
+		char *r = formatString("bas_s(%s)", v);
+		free(v);
+		return r;
+	}
+	return mangle("v_", t.val.s);
+}
 
-		/* array variable */
-		if(strcmp(tokens[1].val.cs, "(") == 0) {
-			int found = 0;
-			for(int i = 2; i < n && !found; i++)
-				if(tokens[i].type == KEYWORD)
-					if(strcmp(tokens[i].val.cs, ")")
-							== 0)
-						found = i;
-			if(!found) {
-				printf("EXPECTED CLOSING BRACE\n");
-				syntaxError(p);
-			}
+char *emitUnary(Emitter *e, Token *tokens, int n, int *i, int *type) {
+	if(*i < n && isKeyword(tokens[*i], KW_MINUS)) {
+		(*i)++;
+		char *s = emitUnary(e, tokens, n, i, type);
+		s = emitInteger(s, *type);
+		*type = INTEGER;
+		char *r = formatString("bas_neg(%s)", s);
+		free(s);
+		return r;
+	}
+	return emitPrimary(e, tokens, n, i, type);
+}
 
-			syntaxAssert(p, tokens[found+1].type == KEYWORD);
-			syntaxAssert(p, strcmp(tokens[found+1].val.cs, "=")
-					== 0);
+const char *cOperator(int kw) {
+	switch(kw) {
+	case KW_EQ:
+		return "==";
+	case KW_NE:
+		return "!=";
+	}
+	return keywords[kw];
+}
 
-			Token t1 = evalExpression(p, tokens+2, found-2);
-			Token t2 = evalExpression(p,
-					tokens+found+2, n-found-2);
-			syntaxAssert(p, t1.type == INTEGER);
+char *emitBinary(Emitter *e, Token *tokens, int n, int *i, int *type,
+		int level)
+{
+	Program *p = e->p;
+	char *s = (level == 2) ? emitUnary(e, tokens, n, i, type)
+		: emitBinary(e, tokens, n, i, type, level+1);
 
-			if(tokens[0].val.s[strlen(tokens[0].val.s)-1]
-					== '$') {
-				syntaxAssert(p, t2.type == STRING);
-				setStringArrayVal(p, tokens[0].val.s,
-						t1.val.i, t2.val.s);
-			}
-			else {
-				syntaxAssert(p, t2.type == INTEGER);
-				setIntegerArrayVal(p, tokens[0].val.s,
-						t1.val.i, t2.val.i);
-			}
+	while(*i < n && operatorLevel(tokens[*i]) == level) {
+		int op = tokens[(*i)++].val.i;
 
-			if(p->last) {
-				free(p->last);
-				p->last = 0;
-			}
-			if(multi)
-				runLine(p, tokens+multi, mn);
-			return 0;
+		int t2;
+		char *s2 = (level == 2) ? emitUnary(e, tokens, n, i, &t2)
+			: emitBinary(e, tokens, n, i, &t2, level+1);
+
+		char *r;
+		if(level == 0 && *type == STRING && t2 == STRING)
+			r = formatString("(strcmp(%s, %s) %s 0)", s, s2,
+					cOperator(op));
+		else {
+			s = emitInteger(s, *type);
+			s2 = emitInteger(s2, t2);
+			/* as doOp: + - * wrap, / and MOD check their divisor */
+			if(op == KW_DIVIDE || op == KW_MOD)
+				r = formatString("bas_%s(%s, %s, %d)",
+						(op == KW_MOD) ? "mod" : "div", s, s2, p->line);
+			else if(level == 0)
+				r = formatString("(%s %s %s)", s, cOperator(op), s2);
+			else
+				r = formatString("(int)((unsigned)%s %s (unsigned)%s)",
+						s, cOperator(op), s2);
 		}
+		free(s);
+		free(s2);
+		s = r;
+		*type = INTEGER;
+	}
+	return s;
+}
 
-		/* non-array variable */
-		syntaxAssert(p, strcmp(tokens[1].val.cs, "=") == 0);
+char *emitNot(Emitter *e, Token *tokens, int n, int *i, int *type) {
+	if(*i < n && isKeyword(tokens[*i], KW_NOT)) {
+		(*i)++;
+		char *s = emitNot(e, tokens, n, i, type);
+		s = emitInteger(s, *type);
+		*type = INTEGER;
+		char *r = formatString("(!%s)", s);
+		free(s);
+		return r;
+	}
+	return emitBinary(e, tokens, n, i, type, 0);
+}
 
-		Token t;
-		t.type = SYMBOL;
-		if(tokens[2].type == KEYWORD)
-			if(strcmp(tokens[2].val.cs, "INPUT") == 0) {
-				if(n > 3) {
-					printToken(evalExpression(p, tokens+3,
-								n-3));
-					printf("\n");
-				}
+char *emitLogic(Emitter *e, Token *tokens, int n, int *i, int *type,
+		int kw)
+{
+	bool is_and = kw == KW_AND;
+	char *s = (is_and) ? emitNot(e, tokens, n, i, type)
+		: emitLogic(e, tokens, n, i, type, KW_AND);
+
+	while(*i < n && isKeyword(tokens[*i], kw)) {
+		(*i)++;
+		int t2;
+		char *s2 = (is_and) ? emitNot(e, tokens, n, i, &t2)
+			: emitLogic(e, tokens, n, i, &t2, KW_AND);
+		s = emitInteger(s, *type);
+		s2 = emitInteger(s2, t2);
+		char *r = formatString("(%s %s %s)", s,
+				(is_and) ? "&&" : "||", s2);
+		free(s);
+		free(s2);
+		s = r;
+		*type = INTEGER;
+	}
+	return s;
+}
 
-				t.val.s = getString();
-				t.type = STRING;
-			}
-		if(t.type == SYMBOL)
-			t = evalExpression(p, tokens+2, n-2);
+char *emitOr(Emitter *e, Token *tokens, int n, int *i, int *type) {
+	return emitLogic(e, tokens, n, i, type, KW_OR);
+}
 
-		if(tokens[0].val.s[strlen(tokens[0].val.s)-1] == '$') {
-			syntaxAssert(p, t.type == STRING);
-			setStringVariable(p, tokens[0].val.s, t.val.s);
-		}
-		else {
-			syntaxAssert(p, t.type == INTEGER);
-			setIntegerVariable(p, tokens[0].val.s, t.val.i);
-		}
+char *emitExpression(Emitter *e, Token *tokens, int n, int *type) {
+	int i = 0;
+	char *s = emitOr(e, tokens, n, &i, type);
+	syntaxAssert(e->p, i == n);
+	return s;
+}
 
-		if(p->last) {
-			free(p->last);
-			p->last = 0;
-		}
-		if(multi)
-			runLine(p, tokens+multi, mn);
-		return 0;
+int addId(int **ids, int *num, int id) {
+	*ids = realloc(*ids, sizeof(int)*(++(*num)));
+	(*ids)[*num-1] = id;
+	return id;
+}
+
+/* jumps can't leave the C function a line was emitted into */
+void checkJump(Emitter *e, int line) {
+	Program *p = e->p;
+	for(int i = 0; i < p->num_functions; i++) {
+		Function *f = &p->functions[i];
+		bool inside = !f->def && line > f->line && line < f->end;
+		if(inside != (e->f == f) && (inside || e->f))
+			cannotCompile(p, "JUMP OUT OF FUNCTION");
 	}
+}
 
-	if(tokens[0].type == LABEL) {
-		syntaxAssert(p, n == 1);
-		return 0;
+/* the C label for a GOTO, GOSUB or ON target */
+char *emitTarget(Emitter *e, Token t) {
+	Program *p = e->p;
+	int line = targetLine(p, t);
+	syntaxAssert(p, line >= 0);
+	if(t.type == INTEGER) {
+		checkJump(e, t.val.i);
+		return formatString("N_%d", t.val.i);
 	}
+	checkJump(e, line);
+	return mangle("L_", t.val.s);
+}
 
-	syntaxAssert(p, tokens[0].type == KEYWORD);
+void emitGosub(Emitter *e) {
+	int id = addId(&e->gosubs, &e->num_gosubs, e->ids++);
+	addId(&e->pending, &e->num_pending, id);
+	fprintf(e->fp, "	bas_gosub(%d);\n", id);
+}
+
+void emitPrint(Emitter *e, char *s, int type) {
+	if(type == STRING)
+		fprintf(e->fp, "\tprintf(\"%%s\", %s);\n", s);
+	else
+		fprintf(e->fp, "\tprintf(\"%%d\", %s);\n", s);
+	free(s);
+}
 
-	/* keywords */
+void emitStatements(Emitter *e, Token *tokens, int n) {
+	Program *p = e->p;
+	FILE *fp = e->fp;
+	int type;
 
-	if(strcmp(tokens[0].val.cs, "IF") == 0) {
+	if(n <= 0)
+		return;
+
+	/* ELSE, IF and REM take the rest of the line */
+	if(isKeyword(tokens[0], KW_REM))
+		return;
+	if(isKeyword(tokens[0], KW_ELSE)) {
+		fprintf(fp, "\tif(bas_else) {\n");
+		emitStatements(e, tokens+1, n-1);
+		fprintf(fp, "\t}\n");
+		return;
+	}
+	if(isKeyword(tokens[0], KW_IF)) {
 		int found = 0;
 		for(int i = 0; i < n && !found; i++)
-			if(tokens[i].type == KEYWORD)
-				if(strcmp(tokens[i].val.cs, "THEN") == 0)
-					found = i;
+			if(isKeyword(tokens[i], KW_THEN))
+				found = i;
 		if(!found) {
-			printf("EXPECT THEN AFTER IF\n");
-			syntaxError(p);
-		}
-		Token t = evalExpression(p, tokens+1, found-1);
-		syntaxAssert(p, t.type == INTEGER);
-		if(t.val.i == 0) {
-			if(p->last) {
-				free(p->last);
-				p->last = 0;
-			}
-			p->do_else = true;
+			runError(p, "EXPECT THEN AFTER IF\n");
+		}
+		char *c = emitExpression(e, tokens+1, found-1, &type);
+		syntaxAssert(p, type == INTEGER);
+		fprintf(fp, "\tif(%s) {\n\tbas_else = 0;\n", c);
+		free(c);
+		emitStatements(e, tokens+found+1, n-found-1);
+		fprintf(fp, "\t}\n\telse\n\t\tbas_else = 1;\n");
+		return;
+	}
 
-			return 0;
+	int m = 0;
+	for(int i = 0; i < n && !m; i++)
+		if(tokens[i].type == COLON)
+			m = i;
+	int rest = (m) ? n-m-1 : 0;
+	Token *after = tokens+m+1; /* assignments move tokens along */
+	if(m)
+		n = m;
+
+	if(tokens[0].type == LABEL) {
+		syntaxAssert(p, n == 1);
+		char *l = mangle("L_", tokens[0].val.s);
+		fprintf(fp, "%s:;\n", l);
+		free(l);
+	}
+	else if(tokens[0].type == SYMBOL) {
+		syntaxAssert(p, n >= 3 && tokens[1].type == KEYWORD);
+		bool is_str = isStringName(tokens[0].val.s);
+		char *d;
+
+		if(isKeyword(tokens[1], KW_LPAREN)) {
+			int found = 0;
+			for(int i = 2; i < n && !found; i++)
+				if(isKeyword(tokens[i], KW_RPAREN))
+					found = i;
+			syntaxAssert(p, found && found < n-1);
+			syntaxAssert(p, isKeyword(tokens[found+1], KW_EQ));
+			if(found == 2)
+				cannotCompile(p, "WHOLE ARRAY ASSIGNMENT");
+			char *x = emitExpression(e, tokens+2, found-2, &type);
+			syntaxAssert(p, type == INTEGER);
+			char *a = mangle((is_str) ? "sa_" : "a_",
+					tokens[0].val.s);
+			d = formatString((is_str) ? "bas_sat(&%s, %s, %d)"
+					: "*bas_iat(&%s, %s, %d)", a, x, p->line);
+			free(a);
+			free(x);
+			tokens += found+2;
+			n -= found+2;
 		}
 		else {
-			p->do_else = false;
+			syntaxAssert(p, isKeyword(tokens[1], KW_EQ));
+			char *v = mangle((is_str) ? "s_" : "v_",
+					tokens[0].val.s);
+			d = (is_str) ? formatString("&%s", v) : v;
+			if(is_str)
+				free(v);
+			tokens += 2;
+			n -= 2;
+		}
 
-			tokens += found+1;
-			n -= found+1;
-			if(multi)
-				multi -= found+1;
+		if(isKeyword(tokens[0], KW_INPUT)) {
+			if(n > 1) {
+				char *x = emitExpression(e, tokens+1, n-1,
+						&type);
+				emitPrint(e, x, type);
+				fprintf(fp, "\tprintf(\"\\n\");\n");
+			}
+			if(is_str)
+				fprintf(fp, "\t{\n\tchar *s = bas_input();\n"
+						"\tbas_set(%s, s);\n\tfree(s);\n"
+						"\t}\n", d);
+			else
+				fprintf(fp, "\t%s = bas_number();\n", d);
 		}
+		else {
+			char *x = emitExpression(e, tokens, n, &type);
+			syntaxAssert(p, type == ((is_str) ? STRING : INTEGER));
+			if(is_str)
+				fprintf(fp, "\tbas_set(%s, %s);\n", d, x);
+			else
+				fprintf(fp, "\t%s = %s;\n", d, x);
+			free(x);
+		}
+		free(d);
 	}
-
-	if(strcmp(tokens[0].val.cs, "PRINT") == 0) {
-		int c = 1;
-		while(c < n) {
-			int oc = c;
-			for(int i = c; i < n && c == oc; i++)
-				if(tokens[i].type == COMMA)
-					c = i;
-			if(c == oc)
-				c = n;
-			printToken(evalExpression(p, tokens+oc, c-oc));
-			c++;
+	else if(isKeyword(tokens[0], KW_PRINT)) {
+		if(n > 1 && isKeyword(tokens[1], KW_HASH))
+			cannotCompile(p, "FILE I/O");
+		int i = 1;
+		while(i < n) {
+			char *x = emitOr(e, tokens, n, &i, &type);
+			emitPrint(e, x, type);
+			if(i < n) {
+				syntaxAssert(p, tokens[i].type == COMMA);
+				i++;
+			}
 		}
-		printf("\n");
+		fprintf(fp, "\tprintf(\"\\n\");\n");
 	}
-	else if(strcmp(tokens[0].val.cs, "INPUT") == 0) {
+	else if(isKeyword(tokens[0], KW_INPUT)) {
 		if(n > 1) {
-			Token t = evalExpression(p, tokens+1, n-1);
-			printToken(t);
-			printf("\n");
+			char *x = emitExpression(e, tokens+1, n-1, &type);
+			emitPrint(e, x, type);
+			fprintf(fp, "\tprintf(\"\\n\");\n");
 		}
-		free(getString());
-		p->last = 0;
+		fprintf(fp, "\tfree(bas_input());\n");
 	}
-	else if(strcmp(tokens[0].val.cs, "FOR") == 0) {
-		syntaxAssert(p, n >= 6);
-
+	else if(isKeyword(tokens[0], KW_FOR)) {
 		int found = 0;
 		for(int i = 0; i < n && !found; i++)
-			if(tokens[i].type == KEYWORD)
-				if(strcmp(tokens[i].val.cs, "TO") == 0)
-					found = i;
+			if(isKeyword(tokens[i], KW_TO))
+				found = i;
 		if(!found) {
-			printf("EXPECT TO AFTER FOR\n");
-			syntaxError(p);
+			runError(p, "EXPECT TO AFTER FOR\n");
 		}
-
-		syntaxAssert(p, tokens[1].type == SYMBOL);
-		syntaxAssert(p, tokens[1].val.s[strlen(tokens[1].val.s)-1]
-				!= '$');
-		syntaxAssert(p, tokens[2].type == KEYWORD);
-		syntaxAssert(p, strcmp(tokens[2].val.cs, "=") == 0);
-
-		Token t1 = evalExpression(p, tokens+3, found-3);
-		Token t2 = evalExpression(p, tokens+found+1, n-found-1);
-		syntaxAssert(p, t1.type == INTEGER && t2.type == INTEGER);
-
-		ForLoop f = (ForLoop) {
-			t1.val.i, t2.val.i, tokens[1].val.s, p->line,
-		};
-		pushForLoop(p, f);
-
-		setIntegerVariable(p, tokens[1].val.s, t1.val.i);
+		syntaxAssert(p, n >= 6 && tokens[1].type == SYMBOL);
+		syntaxAssert(p, !isStringName(tokens[1].val.s));
+		syntaxAssert(p, isKeyword(tokens[2], KW_EQ));
+
+		int t2;
+		char *s1 = emitExpression(e, tokens+3, found-3, &type);
+		char *s2 = emitExpression(e, tokens+found+1, n-found-1, &t2);
+		syntaxAssert(p, type == INTEGER && t2 == INTEGER);
+		char *v = mangle("v_", tokens[1].val.s);
+		int id = addId(&e->fors, &e->num_fors, e->ids++);
+		addId(&e->pending, &e->num_pending, id);
+		fprintf(fp, "\tbas_for(&%s, %s, %s, %d);\n", v, s1, s2, id);
+		free(v);
+		free(s1);
+		free(s2);
 	}
-	else if(strcmp(tokens[0].val.cs, "NEXT") == 0) {
+	else if(isKeyword(tokens[0], KW_NEXT)) {
 		syntaxAssert(p, n == 1);
-		ForLoop f = popForLoop(p);
-
-		int i = getIntegerVariable(p, f.s);
-		bool g = false;
-		if(f.i1 < f.i2) {
-			i++;
-			if(i > f.i2)
-				g = true;
+		fprintf(fp, "\tif((bas_id = bas_next(%d)) >= 0)\n"
+				"\t\tgoto bas_next;\n", p->line);
+	}
+	else if(isKeyword(tokens[0], KW_GOTO) || isKeyword(tokens[0], KW_GOSUB)) {
+		syntaxAssert(p, n == 2);
+		char *l = emitTarget(e, tokens[1]);
+		if(isKeyword(tokens[0], KW_GOSUB))
+			emitGosub(e);
+		fprintf(fp, "\tgoto %s;\n", l);
+		free(l);
+		return;
+	}
+	else if(isKeyword(tokens[0], KW_RETURN)) {
+		if(n > 1) {
+			if(!e->f || e->f->def || e->f->num_locals == e->f->num_params
+					|| strcmp(e->f->locals[e->f->num_params],
+					e->f->identifier) != 0)
+				syntaxError(p);
+			char *x = emitExpression(e, tokens+1, n-1, &type);
+			syntaxAssert(p, type == ((isStringName(e->f->identifier))
+					? STRING : INTEGER));
+			char *v = mangle((type == STRING) ? "s_" : "v_",
+					e->f->identifier);
+			fprintf(fp, "\tif(bas_nreturns != bas_returns0)\n"
+					"\t\tbas_error(%d);\n", p->line);
+			if(type == STRING)
+				fprintf(fp, "\tbas_set(&%s, %s);\n", v, x);
+			else
+				fprintf(fp, "\t%s = %s;\n", v, x);
+			fprintf(fp, "\tgoto bas_end;\n");
+			free(v);
+			free(x);
+			return;
 		}
-		else if(f.i1 > f.i2) {
-			i--;
-			if(i < f.i2)
-				g = true;
+		if(e->f)
+			fprintf(fp, "\tif(bas_nreturns == bas_returns0)\n"
+					"\t\tgoto bas_end;\n");
+		fprintf(fp, "\tbas_id = bas_return(%d);\n\tgoto bas_return;\n",
+				p->line);
+		return;
+	}
+	else if(isKeyword(tokens[0], KW_DIM)) {
+		if(n > 2 && isKeyword(tokens[2], KW_AS))
+			cannotCompile(p, "MAP");
+		syntaxAssert(p, n >= 5 && tokens[1].type == SYMBOL);
+		syntaxAssert(p, isKeyword(tokens[2], KW_LPAREN));
+		syntaxAssert(p, isKeyword(tokens[n-1], KW_RPAREN));
+		char *x = emitExpression(e, tokens+3, n-4, &type);
+		syntaxAssert(p, type == INTEGER);
+		bool is_str = isStringName(tokens[1].val.s);
+		char *a = mangle((is_str) ? "sa_" : "a_", tokens[1].val.s);
+		fprintf(fp, "\t%s(&%s, %s, %d);\n",
+				(is_str) ? "bas_sdim" : "bas_idim", a, x, p->line);
+		free(a);
+		free(x);
+		return;
+	}
+	else if(isKeyword(tokens[0], KW_EXIT)) {
+		fprintf(fp, "\texit(0);\n");
+		return;
+	}
+	else if(isKeyword(tokens[0], KW_RANDOMIZE)) {
+		char *x = emitExpression(e, tokens+1, n-1, &type);
+		syntaxAssert(p, type == INTEGER);
+		fprintf(fp, "\tbas_seed = bas_mix(%s);\n", x);
+		free(x);
+	}
+	else if(isKeyword(tokens[0], KW_END)) {
+		syntaxAssert(p, e->f != 0);
+		fprintf(fp, "\tgoto bas_end;\n");
+		return;
+	}
+	else if(isKeyword(tokens[0], KW_CALL)) {
+		syntaxAssert(p, n >= 2 && tokens[1].type == SYMBOL);
+		Function *f = getFunction(p, tokens[1].val.s);
+		if(!f) {
+			runError(p, "COULD NOT FIND %s\n", tokens[1].val.s);
 		}
-		setIntegerVariable(p, f.s, i);
-
-		if(!g) {
-			pushForLoop(p, f);
-			p->line = f.line;
-			if(p->last)
-				free(p->last);
-			return 1;
+		if(n == 2) {
+			if(f->num_params)
+				cannotCompile(p, "FUNCTION ARGUMENTS");
+			char *fn = mangle("fn_", f->identifier);
+			fprintf(fp, "\t%s();\n", fn);
+			free(fn);
+		}
+		else {
+			char *x = emitExpression(e, tokens+1, n-1, &type);
+			fprintf(fp, "\t%s;\n", x);
+			free(x);
 		}
 	}
-	else if(strcmp(tokens[0].val.cs, "GOTO") == 0) {
-		syntaxAssert(p, n == 2);
-		syntaxAssert(p, tokens[1].type == SYMBOL);
-		p->line = getLabelLine(p, tokens[1].val.s);
-		return 1;
+	else if(tokens[0].type == KEYWORD && (tokens[0].val.i == KW_OPEN
+			|| tokens[0].val.i == KW_CLOSE
+			|| tokens[0].val.i == KW_LINE
+			|| tokens[0].val.i == KW_READ
+			|| tokens[0].val.i == KW_WRITE))
+		cannotCompile(p, "FILE I/O");
+	else if(isKeyword(tokens[0], KW_SNAPSHOT))
+		cannotCompile(p, "SNAPSHOT");
+	else if(isKeyword(tokens[0], KW_ON) && n > 1
+			&& isKeyword(tokens[1], KW_ERROR))
+		cannotCompile(p, "ON ERROR");
+	else if(isKeyword(tokens[0], KW_ON)) {
+		/* a switch the C compiler can turn into a jump table */
+		int found = onJump(tokens, n);
+		syntaxAssert(p, found && (n-found)%2 == 0);
+		char *x = emitExpression(e, tokens+1, found-1, &type);
+		syntaxAssert(p, type == INTEGER);
+		fprintf(fp, "\tswitch(%s) {\n", x);
+		free(x);
+		for(int k = 1; found+2*k-1 < n; k++) {
+			char *l = emitTarget(e, tokens[found+2*k-1]);
+			fprintf(fp, "\tcase %d:\n", k);
+			if(isKeyword(tokens[found], KW_GOSUB))
+				emitGosub(e);
+			fprintf(fp, "\tgoto %s;\n", l);
+			free(l);
+		}
+		fprintf(fp, "\t}\n");
 	}
-	else if(strcmp(tokens[0].val.cs, "GOSUB") == 0) {
-		syntaxAssert(p, n == 2);
-		syntaxAssert(p, tokens[1].type == SYMBOL);
-		pushReturnLine(p, p->line);
-		p->line = getLabelLine(p, tokens[1].val.s);
-		return 1;
+	else if(isKeyword(tokens[0], KW_PARALLEL))
+		cannotCompile(p, "PARALLEL FOR");
+	else if(isKeyword(tokens[0], KW_DELETE))
+		cannotCompile(p, "MAP");
+	else if(!isKeyword(tokens[0], KW_DEF))
+		syntaxError(p);
+
+	if(rest)
+		emitStatements(e, after, rest);
+}
+
+void emitLines(Emitter *e, int from, int to) {
+	Program *p = e->p;
+	for(int l = from; l < to; l++) {
+		bool skip = false;
+		for(int i = 0; i < p->num_functions && !skip; i++)
+			if(!e->f && !p->functions[i].def
+					&& l+1 >= p->functions[i].line
+					&& l+1 <= p->functions[i].end)
+				skip = true;
+		if(skip)
+			continue;
+
+		for(int i = 0; i < e->num_pending; i++)
+			fprintf(e->fp, "J_%d:;\n", e->pending[i]);
+		e->num_pending = 0;
+
+		p->line = l+1;
+		fprintf(e->fp, "\t/* %d */\n", p->line);
+		if(e->numbered[p->line])
+			fprintf(e->fp, "N_%d:;\n", p->line);
+		Line *line = getLine(p, l);
+		emitStatements(e, line->tokens, line->length);
 	}
-	else if(strcmp(tokens[0].val.cs, "RETURN") == 0) {
-		syntaxAssert(p, n == 1);
-		p->line = popReturnLine(p);
-		return 1;
+	for(int i = 0; i < e->num_pending; i++)
+		fprintf(e->fp, "J_%d:;\n", e->pending[i]);
+	e->num_pending = 0;
+
+	fprintf(e->fp, "\tgoto bas_end;\n");
+	if(e->num_fors) {
+		fprintf(e->fp, "bas_next:\n\tswitch(bas_id) {\n");
+		for(int i = 0; i < e->num_fors; i++)
+			fprintf(e->fp, "\tcase %d: goto J_%d;\n",
+					e->fors[i], e->fors[i]);
+		fprintf(e->fp, "\t}\n\tgoto bas_end;\n");
 	}
-	else if(strcmp(tokens[0].val.cs, "DIM") == 0) {
-		syntaxAssert(p, n >= 5);
-		syntaxAssert(p, tokens[1].type == SYMBOL);
-		syntaxAssert(p, tokens[2].type == KEYWORD);
-		syntaxAssert(p, tokens[n-1].type == KEYWORD);
-		syntaxAssert(p, strcmp(tokens[2].val.s, "(") == 0);
-		syntaxAssert(p, strcmp(tokens[n-1].val.s, ")") == 0);
-		Token t = evalExpression(p, tokens+3, n-4);
-		syntaxAssert(p, t.type == INTEGER);
-		if(t.val.i <= 0) {
-			printf("ARRAY SIZE MUST BE > 0\n");
-			syntaxError(p);
-		}
-
-		if(tokens[1].val.s[strlen(tokens[1].val.s)-1] == '$')
-			dimStringArray(p, tokens[1].val.s, t.val.i);
-		else
-			dimIntegerArray(p, tokens[1].val.s, t.val.i);
-		return 0;
+	if(e->num_gosubs) {
+		fprintf(e->fp, "bas_return:\n\tswitch(bas_id) {\n");
+		for(int i = 0; i < e->num_gosubs; i++)
+			fprintf(e->fp, "\tcase %d: goto J_%d;\n",
+					e->gosubs[i], e->gosubs[i]);
+		fprintf(e->fp, "\t}\n\tgoto bas_end;\n");
 	}
-	else if(strcmp(tokens[0].val.cs, "EXIT") == 0) {
-		freeProgram(p);
-		exit(0);
+	e->num_fors = 0;
+	e->num_gosubs = 0;
+}
+
+void emitSignature(Emitter *e, Function *f) {
+	char *fn = mangle("fn_", f->identifier);
+	fprintf(e->fp, "static %s%s(", (isStringName(f->identifier))
+			? "const char *" : "int ", fn);
+	for(int i = 0; i < f->num_params; i++)
+		fprintf(e->fp, "%s%sa%d", (i) ? ", " : "",
+				(isStringName(f->locals[i])) ? "const char *"
+				: "int ", i);
+	fprintf(e->fp, "%s)", (f->num_params) ? "" : "void");
+	free(fn);
+}
+
+void emitFunction(Emitter *e, Function *f) {
+	Program *p = e->p;
+	FILE *fp = e->fp;
+	e->f = f;
+	p->line = f->line;
+
+	emitSignature(e, f);
+	fprintf(fp, " {\n");
+
+	if(f->def) {
+		for(int i = 0; i < f->num_params; i++) {
+			bool is_str = isStringName(f->locals[i]);
+			char *v = mangle((is_str) ? "s_" : "v_", f->locals[i]);
+			fprintf(fp, "\t%s%s = a%d;\n", (is_str)
+					? "const char *" : "int ", v, i);
+			free(v);
+		}
+		Line *l = getLine(p, f->line-1);
+		int type;
+		char *x = emitExpression(e, l->tokens+f->expression,
+				l->length-f->expression, &type);
+		if(type != (isStringName(f->identifier) ? STRING : INTEGER))
+			cannotCompile(p, "FUNCTION RESULT");
+		fprintf(fp, "\treturn %s;\n}\n\n", x);
+		free(x);
+		e->f = 0;
+		return;
 	}
 
-	/* skip this for if false */
-	if(p->last) {
-		free(p->last);
-		p->last = 0;
+	fprintf(fp, "\tint bas_returns0 = bas_nreturns;\n"
+			"\tint bas_loops0 = bas_nloops;\n"
+			"\tint bas_else0 = bas_else;\n");
+	for(int i = 0; i < f->num_locals; i++) {
+		bool is_str = isStringName(f->locals[i]);
+		char *v = mangle((is_str) ? "s_" : "v_", f->locals[i]);
+		if(is_str)
+			fprintf(fp, "\tchar *%s = 0;\n", v);
+		else
+			fprintf(fp, "\tint %s = 0;\n", v);
+		if(i < f->num_params && is_str)
+			fprintf(fp, "\tbas_set(&%s, a%d);\n", v, i);
+		else if(i < f->num_params)
+			fprintf(fp, "\t%s = a%d;\n", v, i);
+		free(v);
 	}
-	if(multi)
-		runLine(p, tokens+multi, mn);
 
-	return 0;
+	emitLines(e, f->line, f->end-1);
+
+	bool has_result = f->num_locals > f->num_params && strcmp(
+			f->locals[f->num_params], f->identifier) == 0;
+	fprintf(fp, "bas_end:\n\tbas_nreturns = bas_returns0;\n"
+			"\tbas_nloops = bas_loops0;\n"
+			"\tbas_else = bas_else0;\n");
+	if(isStringName(f->identifier))
+		fprintf(fp, "\tchar *bas_r = 0;\n");
+	for(int i = 0; i < f->num_locals; i++) {
+		if(!isStringName(f->locals[i]))
+			continue;
+		char *v = mangle("s_", f->locals[i]);
+		if(has_result && i == f->num_params)
+			fprintf(fp, "\tbas_set(&bas_r, bas_s(%s));\n", v);
+		fprintf(fp, "\tfree(%s);\n", v);
+		free(v);
+	}
+
+	if(isStringName(f->identifier) && !has_result)
+		fprintf(fp, "\treturn \"\";\n");
+	else if(isStringName(f->identifier))
+		fprintf(fp, "\treturn bas_temp(bas_r);\n");
+	else if(has_result) {
+		char *v = mangle("v_", f->identifier);
+		fprintf(fp, "\treturn %s;\n", v);
+		free(v);
+	}
+	else
+		fprintf(fp, "\treturn 0;\n");
+	fprintf(fp, "}\n\n");
+	e->f = 0;
 }
 
-void runProgram(Program *p) {
-	p->line = 0;
-	for(int i = 0; i < p->num_tokens; i++) {
-		p->line++;
-		int l = lineLength(p, i);
+/* every symbol gets a global of each kind it could be used as */
+void emitGlobals(Emitter *e) {
+	Program *p = e->p;
+	char **seen = 0;
+	int num_seen = 0;
 
-		if(runLine(p, p->tokens+i, l) == 0)
-			i += l;
-		else {
-			int line = 0;
-			for(i = 0; i < p->num_tokens && line < p->line; i++) {
-				line++;
-				int l = lineLength(p, i);
-				i += l;
+	for(int i = 0; i < p->num_lines; i++)
+	for(int j = 0; j < getLine(p, i)->length; j++) {
+		Token t = p->lines[i].tokens[j];
+		if(t.type != SYMBOL || getFunction(p, t.val.s))
+			continue;
+		bool found = false;
+		for(int j = 0; j < num_seen && !found; j++)
+			if(strcmp(seen[j], t.val.s) == 0)
+				found = true;
+		if(found)
+			continue;
+		seen = realloc(seen, sizeof(char*)*(++num_seen));
+		seen[num_seen-1] = t.val.s;
+
+		bool is_str = isStringName(t.val.s);
+		char *v = mangle((is_str) ? "s_" : "v_", t.val.s);
+		char *a = mangle((is_str) ? "sa_" : "a_", t.val.s);
+		if(is_str)
+			fprintf(e->fp, "static char *%s;\n"
+					"static bas_sarray %s = {0, 0, \"%s\"};\n",
+					v, a, t.val.s);
+		else
+			fprintf(e->fp, "static int %s;\n"
+					"static bas_iarray %s = {0, 0, \"%s\"};\n",
+					v, a, t.val.s);
+		free(v);
+		free(a);
+	}
+	if(seen)
+		free(seen);
+}
+
+/* the C is built in memory and only written out once all of it
+ * translates, so a failure leaves fp empty and its reason on stderr */
+void emitProgram(Program *p, FILE *out) {
+	p->errors = stderr;
+	validateProgram(p);
+	char *text;
+	size_t size;
+	FILE *fp = open_memstream(&text, &size);
+	Emitter e = (Emitter){.p = p, .fp = fp};
+	e.numbered = calloc(p->num_lines+1, sizeof(bool));
+	for(int i = 0; i < p->num_lines; i++) {
+		Line *l = getLine(p, i);
+		for(int j = 0; j < l->length; j++) {
+			if(!isKeyword(l->tokens[j], KW_GOTO)
+					&& !isKeyword(l->tokens[j], KW_GOSUB))
+				continue;
+			for(int k = j+1; k < l->length; k += 2) {
+				Token t = l->tokens[k];
+				if(t.type == INTEGER && t.val.i >= 1
+						&& t.val.i <= p->num_lines)
+					e.numbered[t.val.i] = true;
+				if(k+1 >= l->length || l->tokens[k+1].type != COMMA)
+					break;
 			}
-			i--;
 		}
 	}
+
+	for(const char **l = cRuntime; *l; l++)
+		fprintf(fp, "%s\n", *l);
+	fprintf(fp, "\n");
+
+	emitGlobals(&e);
+	fprintf(fp, "\n");
+
+	for(int i = 0; i < p->num_functions; i++) {
+		emitSignature(&e, &p->functions[i]);
+		fprintf(fp, ";\n");
+	}
+	fprintf(fp, "\n");
+	for(int i = 0; i < p->num_functions; i++)
+		emitFunction(&e, &p->functions[i]);
+
+	fprintf(fp, "int main(void) {\n");
+	emitLines(&e, 0, p->num_lines);
+	fprintf(fp, "bas_end:\n\treturn 0;\n}\n");
+
+	free(e.pending);
+	free(e.fors);
+	free(e.gosubs);
+	free(e.numbered);
+	fclose(fp);
+	fwrite(text, 1, size, out);
+	free(text);
+}
+
+#ifdef FUZZ
+/* libFuzzer entry, see compile.sh. each input runs once interpreted and
+ * once with -j under small budgets, and the two must print the same.
+ * --emit-c is left to compile.sh test, which compiles and runs the C for
+ * the corpus: here it would need a C compiler per input, and the
+ * emitter's strings aren't freed when it refuses a program */
+char *fuzzRun(const char *text, bool jit, size_t *len) {
+	char *out = 0;
+	FILE *fp = open_memstream(&out, len);
+	Program *p = newProgram();
+	p->out = fp;
+	p->jit = jit;
+	p->sandbox = true;
+	p->async_input = true;
+	p->max_steps = 20000;
+	p->max_memory = 1<<20;
+
+	jmp_buf recover;
+	p->recover = &recover;
+	if(setjmp(recover) == 0) {
+		loadString(p, (char*)text);
+		validateProgram(p);
+		p->line = 0;
+		while(resumeProgram(p) == RUN_YIELD)
+			;
+	}
+	p->recover = 0;
+	freeProgram(p);
+	fclose(fp);
+	return out;
 }
 
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	char *text = malloc(size+1);
+	memcpy(text, data, size);
+	text[size] = 0;
+
+	size_t len, jit_len;
+	char *out = fuzzRun(text, false, &len);
+	char *jit_out = fuzzRun(text, true, &jit_len);
+	if(len != jit_len || memcmp(out, jit_out, len) != 0) {
+		fprintf(stderr, "-j changed the output\n--\n%s--\n%s--\n",
+				out, jit_out);
+		abort();
+	}
+	free(out);
+	free(jit_out);
+	free(text);
+	return 0;
+}
+#else
 int main(int argc, char **args) {
-	if(argc <= 1) {
-		printf("BASIC Interpreter - tdwsl 2022\n");
-		printf("usage: %s <file>\n", args[0]);
-		return 0;
+	Program *p = newProgram();
+	const char *filename = 0;
+	bool emit_c = false;
+	bool prompt = false;
+	const char *state = 0;
+	const char *trace = 0;
+	bool replay = false;
+	bool show_memory = false;
+	bool watch = false;
+	for(int i = 1; i < argc; i++) {
+		if(strcmp(args[i], "-j") == 0)
+			p->jit = true;
+		else if(strcmp(args[i], "--emit-c") == 0)
+			emit_c = true;
+		else if(strcmp(args[i], "-i") == 0)
+			prompt = true;
+		else if(strcmp(args[i], "--restore") == 0 && i+1 < argc)
+			state = args[++i];
+		else if(strcmp(args[i], "--max-steps") == 0 && i+1 < argc)
+			p->max_steps = atol(args[++i]);
+		else if(strcmp(args[i], "--max-time") == 0 && i+1 < argc)
+			p->max_time = atol(args[++i]);
+		else if(strcmp(args[i], "--max-memory") == 0 && i+1 < argc)
+			p->max_memory = atol(args[++i]);
+		else if(strcmp(args[i], "--show-memory") == 0)
+			show_memory = true;
+		else if(strcmp(args[i], "--watch") == 0)
+			watch = true;
+		else if(strcmp(args[i], "--sandbox") == 0)
+			p->sandbox = true;
+		else if(strcmp(args[i], "--threads") == 0 && i+1 < argc)
+			p->threads = atoi(args[++i]);
+		else if(strcmp(args[i], "--record") == 0 && i+1 < argc)
+			trace = args[++i];
+		else if(strcmp(args[i], "--replay") == 0 && i+1 < argc) {
+			trace = args[++i];
+			replay = true;
+		}
+		else if(strcmp(args[i], "--show-trace") == 0 && i+1 < argc) {
+			showTrace(args[++i]);
+			freeProgram(p);
+			return 0;
+		}
+		else if(strcmp(args[i], "-h") == 0) {
+			printf("BASIC Interpreter - tdwsl 2022\n");
+			printf("usage: %s [options] [file]\n", args[0]);
+			printf("  -j                 compile hot lines\n");
+			printf("  -i                 load the file and start the "
+					"prompt\n");
+			printf("  --emit-c           print the program as C "
+					"source\n");
+			printf("  --restore image    load a SNAPSHOT image and "
+					"carry on after it\n");
+			printf("  --max-steps n      stop after running n lines\n");
+			printf("  --max-time ms      stop after ms milliseconds\n");
+			printf("  --max-memory bytes stop when variables and "
+					"arrays outgrow this\n");
+			printf("  --show-memory      print the most memory "
+					"variables and arrays took\n");
+			printf("  --sandbox          disable OPEN and SNAPSHOT\n");
+			printf("  --threads n        threads for PARALLEL FOR, "
+					"one per core by default\n");
+			printf("  --record trace     write the run's jumps, IFs and "
+					"INPUT to trace\n");
+			printf("  --replay trace     run again taking INPUT from "
+					"trace\n");
+			printf("  --show-trace trace print a trace\n");
+			printf("  --watch            reload the file when it is saved, "
+					"keeping variables\n");
+			printf("with no file, the prompt starts empty\n");
+			freeProgram(p);
+			return 0;
+		}
+		else if(!filename)
+			filename = args[i];
+		else {
+			printf("too many arguments\n");
+			freeProgram(p);
+			return 1;
+		}
+	}
+	if(!filename && (emit_c || state || trace || watch)) {
+		printf("no file given\n");
+		freeProgram(p);
+		return 1;
 	}
-	if(argc > 2) {
-		printf("too many arguments\n");
+	if(trace && prompt) {
+		printf("traces are only for runs, not the prompt\n");
+		freeProgram(p);
+		return 1;
+	}
+	if(watch && (prompt || trace)) {
+		printf("--watch can't be used with -i or a trace\n");
+		freeProgram(p);
 		return 1;
 	}
 
-	Program *p = newProgram();
-	loadFile(p, args[1]);
+	if(filename)
+		loadFile(p, filename);
+	if(emit_c) {
+		emitProgram(p, stdout);
+		freeProgram(p);
+		return 0;
+	}
+	if(filename)
+		validateProgram(p);
 	/*printProgram(p);*/
-	runProgram(p);
+	if(state)
+		readState(p, state);
+	if(trace)
+		openTrace(p, trace, replay);
+	int status = RUN_DONE;
+	if(!filename || prompt)
+		runRepl(p);
+	else if(watch) {
+		if(!state)
+			p->line = 0;
+		status = watchProgram(p, filename);
+	}
+	else {
+		if(!state)
+			p->line = 0;
+		while((status = resumeProgram(p)) == RUN_YIELD)
+			;
+	}
+	if(show_memory)
+		printf("PEAK MEMORY %ld BYTES\n", p->peak_memory);
 	freeProgram(p);
-	return 0;
+	return status != RUN_DONE;
 }
+#endif
@@ -1 +1,129 @@
-gcc basic.c -o basic
+if [ "$1" = "fuzz" ]; then
+	clang -g -O1 -DFUZZ -fsanitize=fuzzer,address,undefined basic.c -pthread -o fuzz
+elif [ "$1" = "test" ]; then
+	# each tests/*.bas runs with its .in, if any, as stdin and must print
+	# its .out: interpreted, under -j, and as C unless --emit-c refuses it.
+	# both are built with the sanitizers, so any report fails the diff.
+	# a .args file adds options to the first two. tests that start the
+	# prompt with -i aren't run as C, which has no prompt
+	gcc -g -O1 -fsanitize=address,undefined -fno-sanitize-recover=all \
+		basic.c -pthread -o check || exit 1
+	cd tests
+	failed=0
+	for bas in *.bas; do
+		name=${bas%.bas}
+		input=/dev/null
+		[ -f $name.in ] && input=$name.in
+		args=
+		[ -f $name.args ] && args=$(cat $name.args)
+		for mode in "" -j; do
+			if ! ../check $args $mode $bas < $input 2>&1 \
+					| diff -u $name.out -; then
+				echo "FAILED $bas $mode"
+				failed=1
+			fi
+		done
+		case " $args " in
+		*" -i "*)
+			continue
+		esac
+		if ../check --emit-c $bas > $name.c 2> $name.err; then
+			if ! gcc -w -fsanitize=address,undefined \
+					-fno-sanitize-recover=all $name.c -o $name.run \
+					|| ! ./$name.run < $input 2>&1 | diff -u $name.out -; then
+				echo "FAILED $bas --emit-c"
+				failed=1
+			fi
+		elif ! grep -q "CANNOT COMPILE" $name.err \
+				&& ! diff -u $name.out $name.err; then
+			# a program that fails validation reports the same errors
+			echo "FAILED $bas --emit-c"
+			failed=1
+		fi
+		rm -f $name.c $name.err $name.run
+	done
+	# a restored SNAPSHOT carries on from the line after it
+	if ! ../check --restore snapshot.img snapshot.bas 2>&1 \
+			| diff -u snapshot.restored.out -; then
+		echo "FAILED snapshot.bas --restore"
+		failed=1
+	fi
+	# a cut short image, or one with a name that could never have been
+	# lexed, is turned down without running
+	head -c 40 snapshot.img > short.img
+	cp snapshot.img bad.img
+	printf ' ' | dd of=bad.img bs=1 seek=40 conv=notrunc 2> /dev/null
+	for img in short.img bad.img; do
+		if ! ../check --restore $img snapshot.bas 2>&1 \
+				| diff -u snapshot.damaged.out -; then
+			echo "FAILED snapshot.bas --restore $img"
+			failed=1
+		fi
+	done
+	# a replay takes its INPUT from the trace
+	../check --record trace.trace trace.bas < trace.in > /dev/null
+	if ! ../check --replay trace.trace trace.bas < /dev/null 2>&1 \
+			| diff -u trace.out -; then
+		echo "FAILED trace.bas --replay"
+		failed=1
+	fi
+	# and stops where a trace that was cut short ends
+	head -c 16 trace.trace > short.trace
+	if ! ../check --replay short.trace trace.bas < /dev/null 2>&1 \
+			| diff -u trace.short.out -; then
+		echo "FAILED trace.bas --replay of a short trace"
+		failed=1
+	fi
+	# --watch picks up a new version saved while INPUT waits. the
+	# sleeps give it time to get to the INPUT, then to reload
+	for mode in "" -j; do
+		cp watch.bas watch.tmp
+		if ! (sleep 1; cp watch.edit watch.tmp; sleep 1; cat watch.in) \
+				| ../check $mode --watch watch.tmp 2>&1 \
+				| diff -u watch.reload.out -; then
+			echo "FAILED watch.bas --watch $mode with a reload"
+			failed=1
+		fi
+	done
+	rm -f watch.tmp snapshot.img short.img bad.img trace.trace short.trace file.tmp
+	[ $failed = 0 ] && echo "all tests passed"
+	exit $failed
+elif [ "$1" = "bench" ]; then
+	# times tests/bench.bas, best of three, and fails if it got over 25%
+	# slower than tests/bench.baseline. timings depend on the machine, so
+	# "sh compile.sh bench save" records a new baseline
+	gcc -O3 basic.c -pthread -o basic || exit 1
+	results=
+	for mode in interpreted -j; do
+		flag=$mode
+		[ $mode = interpreted ] && flag=
+		best=
+		for run in 1 2 3; do
+			start=$(date +%s%N)
+			./basic $flag tests/bench.bas > /dev/null || exit 1
+			ms=$(( ($(date +%s%N)-start)/1000000 ))
+			[ -z "$best" ] || [ $ms -lt $best ] && best=$ms
+		done
+		results="$results$mode $best
+"
+	done
+	if [ "$2" = "save" ]; then
+		printf "%s" "$results" | tee tests/bench.baseline
+		exit 0
+	fi
+	failed=0
+	while read mode ms; do
+		[ -z "$mode" ] && continue
+		base=$(grep "^$mode " tests/bench.baseline | cut -d' ' -f2)
+		echo "$mode ${ms}ms, baseline ${base}ms"
+		if [ $((ms*100)) -gt $((base*125)) ]; then
+			echo "SLOWER THAN THE BASELINE: $mode"
+			failed=1
+		fi
+	done <<EOF
+$results
+EOF
+	exit $failed
+else
+	gcc -O3 basic.c -pthread -o basic
+fi
@@ -0,0 +1,19 @@
+rem run with --watch, INPUT hands control back to the host, which
+rem resumes the statement that asked once a line comes in
+function ask$(q$)
+  print q$
+  ask$ = input
+end function
+total = 0
+for i = 1 to 3
+  print "number ", i : n = input : total = total+n
+next
+print "total ", total
+gosub more
+if total > 10 then s$ = input : print "then [", s$, "]"
+print ask$("inside a function it blocks")
+exit
+more:
+print "in a gosub" : m = input
+print "got ", m
+return
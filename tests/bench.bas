@@ -0,0 +1,29 @@
+function collatz(n)
+  steps = 0
+  again:
+  if n = 1 then return steps
+  if n mod 2 = 0 then n = n / 2 : goto counted
+  n = 3*n + 1
+  counted:
+  steps = steps + 1
+  goto again
+end function
+dim a(1000)
+total = 0
+for i = 1 to 1000
+  for j = 1 to 1000
+    a(j) = (a(j) + i*j) mod 1009
+    total = total + a(j)
+  next
+next
+longest = 0
+for i = 1 to 10000
+  c = collatz(i)
+  if c > longest then longest = c
+next
+s$ = ""
+for i = 1 to 100000
+  s$ = "x"
+next
+print total
+print longest
@@ -0,0 +1,12 @@
+def sq(x) = x*x
+function fact(n)
+  if n <= 1 then return 1
+  return n*fact(n-1)
+end function
+sub greet(name$)
+  print "Hello, ", name$
+end sub
+print sq(12)
+print fact(10)
+call greet("world")
+n = 3 : print fact(n) : n = sq(n) : print n
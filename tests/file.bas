@@ -0,0 +1,37 @@
+rem writes a file, reads it back, then reads past its end
+open "file.tmp" for output as #1
+for i = 1 to 3
+print #1, "line ", i
+next
+close #1
+open "file.tmp" for append as #2
+print #2, "appended"
+close #2
+
+open "file.tmp" for input as #1
+n = 0
+loop:
+if eof(1) then goto done
+line input #1, s$
+n = n+1
+print n, ": ", s$
+goto loop
+done:
+print "read ", n, " lines"
+line input #1, s$
+print "past the end: [", s$, "] eof ", eof(1)
+close #1
+
+dim a(4)
+for i = 1 to 4
+a(i) = i*i
+next
+open "file.tmp" for output as #1
+write #1, a()
+close #1
+open "file.tmp" for input as #1
+read #1, b()
+close #1
+for i = 1 to 4
+print b(i)
+next
@@ -0,0 +1,9 @@
+rem numeric INPUT asks again until the whole line is one integer
+for i = 1 to 5
+  n = input
+  print "got ", n, " doubled ", n*2
+next
+s$ = input
+print "string [", s$, "]"
+n = input
+print "at the end of input ", n
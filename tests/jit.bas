@@ -0,0 +1,19 @@
+rem under -j the second loop runs as compiled code. x wraps around as
+rem it would interpreted, and at i = 150 the sum bails out part way
+rem through, so the interpreter runs the line again and stops with the
+rem same error
+dim a(200)
+dim d(200)
+for i = 1 to 200
+  a(i) = i*i
+  d(i) = 1 + i mod 7
+next
+d(150) = 0
+t = 0
+x = 1
+for i = 1 to 200
+  x = x*31 + i
+  t = t + x mod 1000 + a(i)/d(i)
+  if i mod 25 = 0 then print i, " ", t, " ", x
+next
+print "not reached"
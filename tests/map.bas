@@ -0,0 +1,14 @@
+dim m as map
+dim n$ as map
+m("one") = 1
+m("two") = 2
+m(3) = 3
+n$("a") = "apple"
+print count(m)
+print m("two"), " ", m("missing"), " ", has(m, 3), " ", has(m, 4)
+delete m("one")
+print count(m)
+for i = 1 to count(m)
+  print key(m, i)
+next
+print n$("a")
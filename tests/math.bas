@@ -0,0 +1,20 @@
+print 17 mod 5
+print -17 mod 5
+print abs(-9)
+print sqr(99)
+print shl(3, 4)
+print shr(256, 3)
+print min(4, 2, 9)
+print max(4, 2, 9)
+randomize 7
+for i = 1 to 5
+  print rnd(100)
+next
+print 2147483647 + 1
+m = -2147483647 - 1
+print -m
+print m / -1
+print m mod -1
+print 65536 * 65536 + 7
+print 7 / 0
+print "never"
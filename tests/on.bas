@@ -0,0 +1,25 @@
+for i = 0 to 4
+  on i goto one, two, three
+  print "none"
+  goto done
+one:
+  print "one"
+  goto done
+two:
+  print "two"
+  goto done
+three:
+  print "three"
+done:
+next
+for i = 1 to 2
+  on i gosub first, second
+next
+goto 25
+first:
+print "first"
+return
+second:
+print "second"
+return
+print "line 25"
@@ -0,0 +1,14 @@
+dim a(1000)
+total = 0
+lo = 1000000
+hi = 0
+parallel for i = 1 to 1000 sum total min lo max hi
+  a(i) = i*i mod 997
+  total = total + a(i)
+  if a(i) < lo then lo = a(i)
+  if a(i) > hi then hi = a(i)
+next
+print total
+print lo
+print hi
+print a(500)
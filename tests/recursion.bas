@@ -0,0 +1,12 @@
+function depth(n)
+  if n = 0 then return 0
+  return 1 + depth(n-1)
+end function
+print depth(500)
+on error goto tooDeep
+function forever(n)
+  return forever(n+1)
+end function
+print forever(1)
+tooDeep:
+print "trapped at line ", erl
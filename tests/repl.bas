@@ -0,0 +1,2 @@
+rem lines loaded from a file are numbered from 1
+print "one"
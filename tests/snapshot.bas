@@ -0,0 +1,7 @@
+dim a(3)
+a(2) = 42
+s$ = "kept"
+for i = 1 to 3
+  if i = 2 then snapshot "snapshot.img"
+  print i, " ", a(2), " ", s$
+next
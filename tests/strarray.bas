@@ -0,0 +1,42 @@
+rem string array elements: short ones inline, long ones packed into
+rem one buffer per array that is compacted once half of it is garbage
+dim a$(6)
+a$(1) = "short"
+a$(2) = "a string long enough to be packed"
+a$(3) = ""
+for i = 1 to 6
+  print i, " [", a$(i), "]"
+next
+
+rem shrinking in place, growing, and going back to inline
+a$(2) = "still longer than inline"
+print a$(2)
+a$(2) = "longer again than it was the first time round"
+print a$(2)
+a$(2) = "tiny"
+print a$(2)
+
+rem copies between elements while the buffer grows under them
+a$(4) = "twenty chars exactly"
+for i = 1 to 20
+  a$(5) = a$(4)
+  a$(4) = a$(5)
+  a$(6) = a$(4)
+next
+print a$(4), " ", a$(5), " ", a$(6)
+
+rem overwriting long text over and over leaves garbage to compact
+for i = 1 to 200
+  if i mod 2 then a$(1 + i mod 6) = "an odd pass writes this one"
+  else a$(1 + i mod 6) = "and an even pass writes this longer one"
+next
+a$(3) = a$(1)
+for i = 1 to 6
+  print i, " [", a$(i), "]"
+next
+
+rem DIM again clears every element
+dim a$(3)
+for i = 1 to 3
+  print i, " [", a$(i), "]"
+next
@@ -0,0 +1,6 @@
+print "number?"
+n = input
+for i = 1 to n
+  if i mod 2 = 0 then print i
+next
+print "done"
@@ -0,0 +1,8 @@
+print "started"
+total = 0
+for i = 1 to 3
+  total = total + i
+  print total
+next
+name$ = total
+print "never"
@@ -0,0 +1,13 @@
+dim a(8)
+dim b(8)
+for i = 1 to 8
+  b(i) = i
+next
+a() = b() * b() + 1
+for i = 1 to 8
+  print a(i)
+next
+a() = a() mod 7 - b()
+for i = 1 to 8
+  print a(i)
+next
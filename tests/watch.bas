@@ -0,0 +1,5 @@
+rem compile.sh saves a new version of this while INPUT waits, and the
+rem run carries on in it with x kept
+x = 41
+n$ = input
+print "hello ", n$